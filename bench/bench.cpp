@@ -0,0 +1,202 @@
+/* microbenchmarks of scheduling overhead, run by bench/bench.py for every
+   $CT_SCHED and $CT_THREADS; prints a line of JSON per measurement.
+
+   usage: bin/bench [repetitions] */
+#include "checkedthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#ifdef CT_OPENMP
+#include <omp.h>
+#endif
+#ifdef CT_TBB
+#include <tbb/tbb.h>
+#endif
+
+double curr_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int g_reps = 20;
+const char* g_sched;
+int g_threads;
+
+/* runs f a few times to warm up caches and spawn threads, then g_reps times,
+   timing each run; reports the median and the minimum per op (ns), where
+   each run of f does ops operations */
+template<class F>
+void bench(const char* name, const char* variant, double ops, const F& f) {
+    std::vector<double> times;
+    int warmup = g_reps/5 + 1;
+    for(int i=0; i<warmup; ++i) {
+        f();
+    }
+    for(int i=0; i<g_reps; ++i) {
+        double start = curr_sec();
+        f();
+        times.push_back(curr_sec() - start);
+    }
+    std::sort(times.begin(), times.end());
+    printf("{\"bench\": \"%s\", \"variant\": \"%s\", \"sched\": \"%s\", \"threads\": %d, "
+           "\"reps\": %d, \"median_ns\": %.3f, \"min_ns\": %.3f}\n",
+           name, variant, g_sched, g_threads, g_reps,
+           times[times.size()/2] * 1e9 / ops, times[0] * 1e9 / ops);
+    fflush(stdout);
+}
+
+volatile int g_sink;
+
+/* the time from calling ctx_for with empty indexes to its return */
+void bench_dispatch() {
+    const int loops = 1000;
+    int ns[] = {1, g_threads, 64};
+    for(int k=0; k<3; ++k) {
+        char variant[32];
+        int n = ns[k];
+        if(k == 1 && (n == 1 || n == 64)) {
+            continue; /* measured anyway */
+        }
+        sprintf(variant, "n=%d", n);
+        bench("empty_loop", variant, loops, [=] {
+            for(int i=0; i<loops; ++i) {
+                ctx_for(n, [](int) {});
+            }
+        });
+    }
+}
+
+/* the time per unit of trivial work, done in indexes of grain units each */
+void bench_grain() {
+    const int units = 1<<20;
+    std::vector<int> arr(units);
+    int* a = &arr[0];
+    int grains[] = {1, 16, 256, 4096};
+    for(int k=0; k<4; ++k) {
+        char variant[32];
+        int grain = grains[k];
+        sprintf(variant, "grain=%d", grain);
+        bench("per_index", variant, units, [=] {
+            ctx_for(units/grain, [=](int i) {
+                for(int j=i*grain; j<(i+1)*grain; ++j) {
+                    a[j] += j;
+                }
+            });
+        });
+    }
+}
+
+/* nested loops: a binary recursion, each level a ctx_for of 2 */
+void recurse(int depth) {
+    if(depth == 0) {
+        return;
+    }
+    ctx_for(2, [=](int) { recurse(depth-1); });
+}
+
+void bench_nested() {
+    const int depth = 12;
+    bench("nested", "depth=12", (1<<depth) - 1, [=] { recurse(depth); });
+}
+
+/* the time from ct_cancel to the return of the loop it cancelled */
+void bench_cancel() {
+    const int n = 1<<20;
+    std::vector<double> latencies;
+    std::vector<int> arr(n); /* a slot per index, rather than a contended g_sink */
+    int* a = &arr[0];
+    bench("cancel", "n=1M", 1, [&] {
+        std::atomic<int> first(0);
+        double cancelled_at = 0;
+        ct_canceller* c = ct_alloc_canceller();
+        ctx_for(n, [&](int i) {
+            if(first.fetch_add(1) == 0) {
+                cancelled_at = curr_sec();
+                ct_cancel(c);
+            }
+            a[i] = i;
+        }, c);
+        latencies.push_back(curr_sec() - cancelled_at);
+        ct_free_canceller(c);
+    });
+    /* bench timed the whole loop; report the latency itself the same way,
+       leaving out the warmup runs */
+    latencies.erase(latencies.begin(), latencies.end() - g_reps);
+    std::sort(latencies.begin(), latencies.end());
+    printf("{\"bench\": \"cancel_latency\", \"variant\": \"n=1M\", \"sched\": \"%s\", \"threads\": %d, "
+           "\"reps\": %d, \"median_ns\": %.3f, \"min_ns\": %.3f}\n",
+           g_sched, g_threads, (int)latencies.size(),
+           latencies[latencies.size()/2] * 1e9, latencies[0] * 1e9);
+}
+
+/* summing an array with ctx_for over chunks, and natively where available */
+void bench_reduce() {
+    const int n = 1<<22, chunks = 256;
+    std::vector<int> arr(n, 1);
+    const int* a = &arr[0];
+    bench("reduce", "checkedthreads", n, [=] {
+        long part[chunks];
+        ctx_for(chunks, [&](int i) {
+            long sum = 0;
+            for(int j=i*(n/chunks); j<(i+1)*(n/chunks); ++j) {
+                sum += a[j];
+            }
+            part[i] = sum;
+        });
+        long sum = 0;
+        for(int i=0; i<chunks; ++i) {
+            sum += part[i];
+        }
+        g_sink = (int)sum;
+    });
+#ifdef CT_OPENMP
+    omp_set_num_threads(g_threads);
+    bench("reduce", "openmp", n, [=] {
+        long sum = 0;
+#pragma omp parallel for reduction(+:sum)
+        for(int j=0; j<n; ++j) {
+            sum += a[j];
+        }
+        g_sink = (int)sum;
+    });
+#endif
+#ifdef CT_TBB
+    tbb::task_arena arena(g_threads);
+    bench("reduce", "tbb", n, [&] {
+        arena.execute([&] {
+            g_sink = (int)tbb::parallel_reduce(tbb::blocked_range<int>(0, n, n/chunks), 0L,
+                [=](const tbb::blocked_range<int>& r, long sum) {
+                    for(int j=r.begin(); j<r.end(); ++j) {
+                        sum += a[j];
+                    }
+                    return sum;
+                }, [](long x, long y) { return x + y; });
+        });
+    });
+#endif
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        g_reps = atoi(argv[1]);
+    }
+    g_sched = getenv("CT_SCHED") ? getenv("CT_SCHED") : "default";
+    g_threads = getenv("CT_THREADS") ? atoi(getenv("CT_THREADS")) : 0;
+    if(g_threads <= 0) {
+        g_threads = (int)sysconf(_SC_NPROCESSORS_ONLN); /* as with $CT_THREADS=0 */
+    }
+    ct_init(0);
+    bench_dispatch();
+    bench_grain();
+    bench_nested();
+    bench_cancel();
+    bench_reduce();
+    ct_fini();
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+'''scheduling overhead and scaling benchmarks: builds bin/bench (bench/bench.cpp)
+and runs it with every given $CT_SCHED and $CT_THREADS, writing a line of JSON
+per measurement (see bench.cpp) to the output file, and printing a table.
+
+run from the checkedthreads root directory after make build:
+
+./bench/bench.py                              # all parallel schedulers, 1,2,4... threads up to the cores
+./bench/bench.py -o base.json                 # the output file (bench.json by default)
+./bench/bench.py -s pthreads,openmp -t 1,8    # the schedulers and thread counts to sweep
+./bench/bench.py -r 50                        # repetitions per measurement (20 by default)
+
+compare two runs with bench/compare.py.
+'''
+import sys, os, json, optparse, commands
+sys.path.insert(0, '.')
+import build
+
+def nprocs():
+    return int(commands.getoutput('getconf _NPROCESSORS_ONLN'))
+
+def default_scheds():
+    scheds = ['serial']
+    if 'pthreads' in build.enabled: scheds.append('pthreads')
+    if 'OpenMP' in build.enabled: scheds.append('openmp')
+    if 'TBB' in build.enabled: scheds.append('tbb')
+    return scheds
+
+def default_threads():
+    threads = [1]
+    while threads[-1]*2 <= nprocs():
+        threads.append(threads[-1]*2)
+    if threads[-1] != nprocs():
+        threads.append(nprocs())
+    return threads
+
+def build_bench():
+    if 'C++11' not in build.enabled:
+        print 'the benchmarks need C++11'
+        sys.exit(1)
+    build.mkdir('bin')
+    build.update('g++ bench/bench.cpp -o bin/bench lib/lib%s.a -I include %s'%(build.libxx,build.all_enabled('linker_flags')),
+                 ['bin/bench'],['bench/bench.cpp'])
+
+def run(sched, threads, reps):
+    command = 'env CT_SCHED=%s CT_THREADS=%d ./bin/bench %d'%(sched,threads,reps)
+    if build.verbose:
+        print ' ','running',command
+    status, output = commands.getstatusoutput(command)
+    if status != 0:
+        print command,'failed with status',status
+        print output
+        sys.exit(1)
+    return [json.loads(line) for line in output.split('\n') if line.startswith('{')]
+
+def main():
+    parser = optparse.OptionParser()
+    parser.add_option('-o', dest='output', default='bench.json')
+    parser.add_option('-s', dest='scheds', default=','.join(default_scheds()))
+    parser.add_option('-t', dest='threads', default=','.join([str(t) for t in default_threads()]))
+    parser.add_option('-r', dest='reps', type='int', default=20)
+    options, args = parser.parse_args()
+
+    build_bench()
+    out = open(options.output, 'w')
+    print '%-16s %-16s %-10s %7s %14s %14s'%('benchmark','variant','sched','threads','median(ns/op)','min(ns/op)')
+    for sched in options.scheds.split(','):
+        for threads in [int(t) for t in options.threads.split(',')]:
+            if sched == 'serial' and threads > 1:
+                continue
+            for r in run(sched, threads, options.reps):
+                out.write(json.dumps(r, sort_keys=True)+'\n')
+                print '%-16s %-16s %-10s %7d %14.1f %14.1f'%(r['bench'],r['variant'],r['sched'],r['threads'],
+                                                           r['median_ns'],r['min_ns'])
+    out.close()
+    print 'results written to',options.output
+
+if __name__ == '__main__':
+    main()
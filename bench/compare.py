@@ -0,0 +1,43 @@
+#!/usr/bin/python
+'''compares two outputs of bench/bench.py, flagging measurements whose median
+got slower by more than a threshold (10% by default); exits with status 1
+if there are any such regressions.
+
+./bench/compare.py base.json new.json
+./bench/compare.py -t 0.25 base.json new.json    # flag slowdowns of more than 25%
+'''
+import sys, json, optparse
+
+def key(r):
+    return (r['bench'], r['variant'], r['sched'], r['threads'])
+
+def load(fname):
+    return dict([(key(r), r) for r in [json.loads(line) for line in open(fname) if line.strip()]])
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [-t threshold] base.json new.json')
+    parser.add_option('-t', dest='threshold', type='float', default=0.1)
+    options, args = parser.parse_args()
+    if len(args) != 2:
+        parser.error('expected two result files')
+    base, new = load(args[0]), load(args[1])
+
+    regressions = 0
+    print '%-16s %-16s %-10s %7s %12s %12s %8s'%('benchmark','variant','sched','threads','base(ns/op)','new(ns/op)','change')
+    for k in sorted(set(base) & set(new)):
+        b, n = base[k]['median_ns'], new[k]['median_ns']
+        change = n/b - 1 if b > 0 else 0
+        flag = ''
+        if change > options.threshold:
+            flag = 'REGRESSION'
+            regressions += 1
+        elif change < -options.threshold:
+            flag = 'improved'
+        print '%-16s %-16s %-10s %7d %12.1f %12.1f %+7.1f%% %s'%(k+(b,n,100*change,flag))
+    for k in sorted(set(base) ^ set(new)):
+        print '%-16s %-16s %-10s %7d only in %s'%(k+(args[0] if k in base else args[1],))
+    print '%d regressions (slower by more than %.0f%%)'%(regressions, 100*options.threshold)
+    sys.exit(1 if regressions else 0)
+
+if __name__ == '__main__':
+    main()
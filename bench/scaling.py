@@ -0,0 +1,163 @@
+#!/usr/bin/python
+'''thread scaling of a checkedthreads program: runs it with $CT_THREADS=1..N,
+pinned to as many cores (with taskset, if available) and repeated, collecting
+the wall time and the $CT_STATS counters; prints speedup and efficiency,
+flags scaling knees and guesses their bottleneck from the counters.
+
+run from the checkedthreads root directory:
+
+./bench/scaling.py ./bin/grain 10                  # 1,2,4... threads up to the cores
+./bench/scaling.py -t 1,2,3,4 -r 5 ./bin/sort      # the thread counts; repetitions (3 by default)
+./bench/scaling.py -s openmp ./bin/acc             # $CT_SCHED (pthreads by default; only pthreads
+                                                   # and pshuffle keep the counters used for diagnosis)
+./bench/scaling.py -o scaling.csv ./bin/acc        # also write the table as CSV...
+./bench/scaling.py -p scaling.png ./bin/acc        # ...or plot it (needs matplotlib)
+
+speedup is relative to the first thread count, assuming linear speedup up to it.
+a knee is where adding threads gains less than half a thread's worth of
+speedup. its bottleneck is guessed from the change in the counters between
+the thread counts around it:
+* more threads than cores - if that's the case, the rest isn't checked;
+* queue lock - more than 20% of the queue lock's acquisitions are contended;
+* memory bandwidth (or another shared resource) - the workers' total busy time
+  grew by more than 30%, that is, the same indexes run slower on more threads;
+* wakeups - the workers are idle (sleeping until there's work) over 30% of the time;
+* load imbalance - the workers spin (waiting for others to finish a loop) over
+  30% of the time, or the mean index imbalance is above 1.5;
+* otherwise, serial code - the time outside loops (Amdahl's law).
+'''
+import sys, os, json, time, optparse, commands
+
+def nprocs():
+    return int(commands.getoutput('getconf _NPROCESSORS_ONLN'))
+
+def default_threads():
+    threads = [1]
+    while threads[-1]*2 <= nprocs():
+        threads.append(threads[-1]*2)
+    if threads[-1] != nprocs():
+        threads.append(nprocs())
+    return threads
+
+def have_taskset():
+    return commands.getstatusoutput('taskset -c 0 true')[0] == 0
+
+def run(command, sched, threads, pin):
+    taskset = 'taskset -c 0-%d '%(min(threads, nprocs())-1) if pin else ''
+    cmd = 'env CT_SCHED=%s CT_THREADS=%d CT_STATS=json %s%s'%(sched, threads, taskset, command)
+    start = time.time()
+    status, output = commands.getstatusoutput(cmd)
+    wall = time.time() - start
+    if status != 0:
+        print cmd,'failed with status',status
+        print output
+        sys.exit(1)
+    stats = [json.loads(line) for line in output.split('\n') if line.startswith('{"loops"')]
+    return wall, stats[-1] if stats else None
+
+def has_counters(stats):
+    '''only the pthreads-based schedulers keep the queue and time counters'''
+    return stats and any([w['busy'] + w['spin'] + w['idle'] > 0 for w in stats['workers']])
+
+def median(values):
+    return sorted(values)[len(values)/2]
+
+def fractions(stats):
+    '''the workers' busy, spin and idle time, and those times' fractions'''
+    busy = sum([w['busy'] for w in stats['workers']])
+    spin = sum([w['spin'] for w in stats['workers']])
+    idle = sum([w['idle'] for w in stats['workers']])
+    total = max(busy + spin + idle, 1e-9)
+    return busy, spin/total, idle/total
+
+def bottleneck(prev, curr, threads):
+    if threads > nprocs():
+        return 'more threads (%d) than cores (%d)'%(threads, nprocs())
+    if not has_counters(prev) or not has_counters(curr):
+        return 'unknown (no scheduler counters; use -s pthreads)'
+    busy1, _, _ = fractions(prev)
+    busy2, spin, idle = fractions(curr)
+    contention = float(curr['lock_contentions']) / max(curr['lock_acquisitions'], 1)
+    if contention > 0.2:
+        return 'queue lock (%.0f%% of acquisitions contended)'%(100*contention)
+    if busy1 > 0 and busy2 > 1.3*busy1:
+        return 'memory bandwidth or another shared resource (total busy time grew %.1fx)'%(busy2/busy1)
+    if idle > 0.3:
+        return 'wakeups (workers idle %.0f%% of the time - loops too small or too few)'%(100*idle)
+    if spin > 0.3 or curr['mean_imbalance'] > 1.5:
+        return 'load imbalance (workers spinning %.0f%% of the time, mean index imbalance %.2f)'%(100*spin, curr['mean_imbalance'])
+    return 'serial code outside loops'
+
+def plot(rows, fname):
+    try:
+        import matplotlib
+        matplotlib.use('Agg')
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print 'matplotlib is unavailable - not plotting (use -o to write a CSV instead)'
+        return
+    threads = [r['threads'] for r in rows]
+    plt.plot(threads, [r['speedup'] for r in rows], 'o-', label='speedup')
+    plt.plot(threads, threads, ':', label='linear')
+    plt.xlabel('threads')
+    plt.ylabel('speedup')
+    plt.legend(loc='upper left')
+    plt.savefig(fname)
+    print 'plot written to',fname
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] program [args]')
+    parser.disable_interspersed_args()
+    parser.add_option('-t', dest='threads', default=','.join([str(t) for t in default_threads()]))
+    parser.add_option('-r', dest='reps', type='int', default=3)
+    parser.add_option('-s', dest='sched', default='pthreads')
+    parser.add_option('-o', dest='csv')
+    parser.add_option('-p', dest='plot')
+    parser.add_option('--no-pin', dest='pin', action='store_false', default=True)
+    options, args = parser.parse_args()
+    if not args:
+        parser.error('expected a program to run')
+    command = ' '.join(args)
+    pin = options.pin and have_taskset()
+
+    rows = []
+    for threads in [int(t) for t in options.threads.split(',')]:
+        runs = [run(command, options.sched, threads, pin) for rep in range(options.reps)]
+        wall = median([w for w, s in runs])
+        stats = [s for w, s in runs if w == wall][0]
+        rows.append(dict(threads=threads, wall=wall, stats=stats))
+    for r in rows:
+        r['speedup'] = rows[0]['wall'] * rows[0]['threads'] / r['wall']
+        r['efficiency'] = r['speedup'] / r['threads']
+
+    print '%7s %10s %8s %10s %11s %6s %6s %9s'%('threads','time(s)','speedup','efficiency','contended','spin','idle','imbalance')
+    for r in rows:
+        s = r['stats']
+        if has_counters(s):
+            _, spin, idle = fractions(s)
+            counters = '%10.1f%% %5.0f%% %5.0f%% %9.2f'%(100.*s['lock_contentions']/max(s['lock_acquisitions'],1),
+                                                      100*spin, 100*idle, s['mean_imbalance'])
+        else:
+            counters = '%11s %6s %6s %9s'%('-','-','-','-')
+        print '%7d %10.3f %8.2f %9.0f%% %s'%(r['threads'], r['wall'], r['speedup'], 100*r['efficiency'], counters)
+
+    for prev, curr in zip(rows, rows[1:]):
+        if curr['threads'] <= prev['threads']:
+            continue
+        gain = (curr['speedup'] - prev['speedup']) / (curr['threads'] - prev['threads'])
+        if gain < 0.5:
+            print 'knee: from %d to %d threads, each added thread gains a speedup of %.2f; likely bottleneck: %s'%(
+                  prev['threads'], curr['threads'], gain, bottleneck(prev['stats'], curr['stats'], curr['threads']))
+
+    if options.csv:
+        f = open(options.csv, 'w')
+        f.write('threads,time,speedup,efficiency\n')
+        for r in rows:
+            f.write('%d,%f,%f,%f\n'%(r['threads'], r['wall'], r['speedup'], r['efficiency']))
+        f.close()
+        print 'table written to',options.csv
+    if options.plot:
+        plot(rows, options.plot)
+
+if __name__ == '__main__':
+    main()
@@ -26,8 +26,8 @@ those schedulers built into checkedthreads.
 '''
 
 dirs = 'obj lib bin'.split()
-srcsc = 'ct_api.c serial_imp.c pthreads_imp.c openmp_imp.c shuffle_imp.c valgrind_imp.c'.split() +\
-        'lock_based_queue.c nprocs.c work_item.c'.split()
+srcsc = 'ct_api.c serial_imp.c pthreads_imp.c openmp_imp.c shuffle_imp.c valgrind_imp.c profile_imp.c'.split() +\
+        'lock_based_queue.c nprocs.c work_item.c rand_perm.c clock.c stats.c trace.c perf_counters.c imbalance.c'.split()
 srcsxx = 'ctx_api.cpp tbb_imp.cpp'.split()
 libc = 'checkedthreads'
 libxx = 'checkedthreads++'
@@ -44,6 +44,7 @@ features = {
     'OpenMP': dict(compiler_flags='-fopenmp'),
     'TBB': dict(linker_flags='-ltbb'), 
     'pthreads': dict(compiler_flags='-pthread'),
+    'USDT': dict(),
 }
 
 def enabled_features():
@@ -18,3 +18,7 @@ TBB enabled
 #ifdef CT_PTHREADS
 pthreads enabled
 #endif
+
+#ifdef CT_USDT
+USDT enabled
+#endif
@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/sdt.h>
+
+/* the probes' arities and argument types are those of src/probes.h's users,
+   so that configure only enables CT_USDT if they build warning-free under
+   the library's flags */
+void index_func(int i, void* context) {
+    (void)i; (void)context;
+}
+
+int main() {
+    int n = 1;
+    const char* name = "test";
+    void* item = &n;
+    DTRACE_PROBE1(checkedthreads_cfg, test1, item);
+    DTRACE_PROBE2(checkedthreads_cfg, test2, item, n);
+    DTRACE_PROBE3(checkedthreads_cfg, test3, n, (size_t)index_func, name);
+    printf("USDT test passed\n");
+    return 0;
+}
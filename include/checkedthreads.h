@@ -19,11 +19,16 @@ typedef struct {
 
    environment variables:
 
-   $CT_SCHED: serial, shuffle, valgrind, openmp, tbb, pthreads.
+   $CT_SCHED: serial, shuffle, valgrind, openmp, tbb, pthreads, pshuffle, profile.
    $CT_THREADS: number of threads, including main; "0" means "a thread per core".
    $CT_VERBOSE: 2(print indexes), 1(print loops), 0(silent-default).
-   $CT_RAND_SEED: seed for schedulers randomizing order (shuffle & valgrind).
+   $CT_RAND_SEED: seed for schedulers randomizing order (shuffle, pshuffle & valgrind).
    $CT_RAND_REV: reverse each random index sequence yielded by the given seed.
+   $CT_RAND_YIELD: percentage of indexes before which pshuffle's workers yield the CPU.
+   $CT_STATS: 1 (print statistics at ct_fini), json (print them as JSON), 0 (don't collect-default).
+   $CT_TRACE: a file to write a Chrome trace of the loops to at ct_fini (none by default).
+   $CT_PERF_COUNTERS: hardware counters to print per loop at ct_fini, such as cycles,instructions,cache-misses.
+   $CT_IMBALANCE: warn about loops whose busiest worker ran longer than this multiple of the mean (0 - off - by default).
 
    note that the parallel schedulers such as openmp and tbb currently
    specify two things which are conceptually separate: the "threading platform"
@@ -60,6 +65,10 @@ void ct_invoke(const ct_task tasks[], ct_canceller* c);
 /* N async function calls f(0) ... f(n-1) */
 typedef void (*ct_ind_func)(int ind, void* context);
 void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c);
+/* ct_for naming the loop in verbose output, statistics and traces. the name
+   is kept by pointer, so it must outlive ct_fini (a string literal will do);
+   loops run by ct_for are named by the address of their call site. */
+void ct_for_named(const char* name, int n, ct_ind_func f, void* context, ct_canceller* c);
 
 /* under Valgrind or other ownership-tracking environment,
    returns an ID of the owner of the given address; elsewhere,
@@ -68,6 +77,57 @@ void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c);
 #define CT_OWNER_UNKNOWN (-2) /* not under Valgrind or equivalent */
 int ct_debug_get_owner(const void* addr);
 
+/* runtime statistics, collected if $CT_STATS is set. the counts are summed
+   over the workers; the queue, imbalance and time statistics are only kept
+   by the pthreads and pshuffle schedulers. */
+typedef struct {
+    unsigned long loops; /* ct_for and ct_invoke calls */
+    unsigned long indexes;
+    int max_depth; /* of loop nesting - 1 if no loop was nested in another */
+    unsigned long queue_full; /* indexes run by a spawning thread since the queue was full */
+    unsigned long lock_acquisitions; /* of the queue's lock */
+    unsigned long lock_contentions; /* acquisitions which had to wait for another thread */
+    unsigned long balanced_loops; /* loops whose imbalance was measured */
+    double mean_imbalance; /* most indexes run by a worker in a loop / an even share */
+    double max_imbalance;
+    int num_workers;
+} ct_stats;
+
+/* seconds spent by a worker in each state */
+typedef struct {
+    double busy; /* running indexes (or, for worker 0, code outside loops) */
+    double spin; /* looking for work, or waiting for others to finish a loop */
+    double idle; /* sleeping until work is available */
+} ct_worker_stats;
+
+/* fills stats and up to max_workers entries of workers (which may be 0).
+   returns 0 if statistics aren't collected, 1 if they are. */
+int ct_get_stats(ct_stats* stats, ct_worker_stats* workers, int max_workers);
+
+/* hooks for external profilers, called by the thread where the event happens
+   with the user pointer and the calling worker's ID - below $CT_THREADS, or
+   equal to it for threads outside the scheduler's pool. any hook may be 0.
+   a loop's name is 0 unless it was given to ct_for_named, otherwise the loop
+   is identified by the caller address. worker start/stop is reported for the
+   threads spawned by the pthreads, pshuffle and tbb schedulers; chunks (the
+   indexes of a loop run by a worker in one go) for those and for openmp;
+   parking for pthreads and pshuffle. */
+typedef struct {
+    void (*loop_begin)(void* user, int worker, const char* name, const void* caller, int n);
+    void (*loop_end)(void* user, int worker);
+    void (*worker_start)(void* user, int worker);
+    void (*worker_stop)(void* user, int worker);
+    void (*chunk_begin)(void* user, int worker);
+    void (*chunk_end)(void* user, int worker, int indexes_run);
+    void (*park)(void* user, int worker); /* sleeping until there's work */
+    void (*unpark)(void* user, int worker);
+    void* user;
+} ct_hooks;
+
+/* the hooks are copied; 0 removes them. call outside parallel loops,
+   and before ct_init to see the workers start. */
+void ct_set_hooks(const ct_hooks* hooks);
+
 #ifdef __cplusplus
 } /* extern "C" */
 
@@ -78,6 +138,7 @@ int ct_debug_get_owner(const void* addr);
 typedef std::function<void(int)> ctx_ind_func;
 
 void ctx_for(int n, const ctx_ind_func& f, ct_canceller* c=0);
+void ctx_for(const char* name, int n, const ctx_ind_func& f, ct_canceller* c=0); /* see ct_for_named */
 
 typedef std::function<void(void)> ctx_task_func;
 struct ctx_task_node_ {
@@ -0,0 +1,9 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime under -std=c89 */
+#include <time.h>
+#include "clock.h"
+
+double ct_curr_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
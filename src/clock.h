@@ -0,0 +1,7 @@
+#ifndef CT_CLOCK_H_
+#define CT_CLOCK_H_
+
+/* seconds from an arbitrary point, from a monotonic clock */
+double ct_curr_sec(void);
+
+#endif
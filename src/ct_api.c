@@ -2,6 +2,14 @@
 #include <string.h>
 #include <stdio.h>
 #include "imp.h"
+#include "stats.h"
+#include "trace.h"
+#include "clock.h"
+#include "probes.h"
+#include "perf_counters.h"
+#include "imbalance.h"
+#include "nprocs.h"
+#include "atomic.h"
 
 extern ct_imp g_ct_tbb_imp;
 extern ct_imp g_ct_serial_imp;
@@ -9,6 +17,8 @@ extern ct_imp g_ct_openmp_imp;
 extern ct_imp g_ct_shuffle_imp;
 extern ct_imp g_ct_valgrind_imp;
 extern ct_imp g_ct_pthreads_imp;
+extern ct_imp g_ct_pshuffle_imp;
+extern ct_imp g_ct_profile_imp;
 
 ct_imp* g_ct_imps[] = {
     &g_ct_tbb_imp,
@@ -17,12 +27,18 @@ ct_imp* g_ct_imps[] = {
     &g_ct_shuffle_imp,
     &g_ct_valgrind_imp,
     &g_ct_pthreads_imp,
+    &g_ct_pshuffle_imp,
+    &g_ct_profile_imp,
     0
 };
 
 ct_imp* g_ct_pimpl;
 int g_ct_verbose;
 ct_canceller* g_ct_default_canceller;
+int g_ct_num_workers;
+volatile int g_ct_other_workers_lock; /* guards the slot shared by threads without a worker ID */
+ct_hooks g_ct_hooks_set;
+const ct_hooks* g_ct_hooks;
 
 const char* ct_getenv(const ct_env_var* env, const char* name, const char* default_value) {
     int i=0;
@@ -39,6 +55,75 @@ const char* ct_getenv(const ct_env_var* env, const char* name, const char* defau
     return got ? got : default_value;
 }
 
+const char* ct_site_name(const char* name, const void* caller, char buf[CT_SITE_NAME_SIZE]) {
+    if(name) {
+        return name;
+    }
+    sprintf(buf, "0x%lx", (unsigned long)(size_t)caller);
+    return buf;
+}
+
+void ct_print_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for(; *s; ++s) {
+        if(*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        if((unsigned char)*s >= ' ') {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+int ct_worker_id(void) {
+    int id = g_ct_pimpl->imp_worker_id ? g_ct_pimpl->imp_worker_id() : 0;
+    return id >= 0 && id < g_ct_num_workers ? id : g_ct_num_workers;
+}
+
+void ct_lock_worker(int worker) {
+    if(worker == g_ct_num_workers) {
+        while(ATOMIC_COMPARE_AND_SWAP(&g_ct_other_workers_lock, 0, 1) != 0);
+    }
+}
+
+void ct_unlock_worker(int worker) {
+    if(worker == g_ct_num_workers) {
+        ATOMIC_COMPARE_AND_SWAP(&g_ct_other_workers_lock, 1, 0);
+    }
+}
+
+void ct_no_loop_begin_hook(void* user, int worker, const char* name, const void* caller, int n) {
+    (void)user; (void)worker; (void)name; (void)caller; (void)n;
+}
+
+void ct_no_worker_hook(void* user, int worker) {
+    (void)user; (void)worker;
+}
+
+void ct_no_chunk_end_hook(void* user, int worker, int indexes_run) {
+    (void)user; (void)worker; (void)indexes_run;
+}
+
+/* unset hooks are replaced with no-ops, so that the hooks are called
+   after a single check of g_ct_hooks */
+void ct_set_hooks(const ct_hooks* hooks) {
+    if(!hooks) {
+        g_ct_hooks = 0;
+        return;
+    }
+    g_ct_hooks_set = *hooks;
+    if(!g_ct_hooks_set.loop_begin) g_ct_hooks_set.loop_begin = ct_no_loop_begin_hook;
+    if(!g_ct_hooks_set.loop_end) g_ct_hooks_set.loop_end = ct_no_worker_hook;
+    if(!g_ct_hooks_set.worker_start) g_ct_hooks_set.worker_start = ct_no_worker_hook;
+    if(!g_ct_hooks_set.worker_stop) g_ct_hooks_set.worker_stop = ct_no_worker_hook;
+    if(!g_ct_hooks_set.chunk_begin) g_ct_hooks_set.chunk_begin = ct_no_worker_hook;
+    if(!g_ct_hooks_set.chunk_end) g_ct_hooks_set.chunk_end = ct_no_chunk_end_hook;
+    if(!g_ct_hooks_set.park) g_ct_hooks_set.park = ct_no_worker_hook;
+    if(!g_ct_hooks_set.unpark) g_ct_hooks_set.unpark = ct_no_worker_hook;
+    g_ct_hooks = &g_ct_hooks_set;
+}
+
 ct_imp* ct_sched(const char* name) {
     int i=0;
     while(g_ct_imps[i]) {
@@ -83,6 +168,15 @@ void ct_init(const ct_env_var* env) {
        that is, with truly parallel schedulers. */
     g_ct_verbose = atoi(ct_getenv(env, "CT_VERBOSE", "0"));
 
+    /* the pthreads scheduler's worker IDs are below $CT_THREADS */
+    g_ct_num_workers = atoi(ct_getenv(env, "CT_THREADS", "0"));
+    if(g_ct_num_workers <= 0) {
+        g_ct_num_workers = ct_nprocs();
+    }
+    ct_stats_init(env); /* before imp_init spawns workers */
+    ct_trace_init(env);
+    ct_perf_init(env);
+    ct_imbalance_init(env);
     g_ct_pimpl->imp_init(env);
 
     g_ct_default_canceller = ct_alloc_canceller();
@@ -95,6 +189,9 @@ void ct_init(const ct_env_var* env) {
 void ct_fini(void) {
     ct_free_canceller(g_ct_default_canceller);
     g_ct_pimpl->imp_fini();
+    ct_stats_fini(); /* after imp_fini joins the workers */
+    ct_trace_fini();
+    ct_perf_fini();
     g_ct_pimpl = 0;
     if(g_ct_verbose) {
         printf("checkedthreads: finalized\n");
@@ -118,6 +215,7 @@ void ct_free_canceller(ct_canceller* c) {
 }
 
 void ct_cancel(ct_canceller* c) {
+    CT_PROBE1(cancel, c);
     c->cancelled = 1;
     if(g_ct_pimpl->imp_cancel) {
         g_ct_pimpl->imp_cancel(c);
@@ -137,7 +235,7 @@ void ct_dispatch_task(int index, void* context) {
 void ct_invoke(const ct_task tasks[], ct_canceller* c) {
     int i;
     for(i=0; tasks[i].func; ++i);
-    ct_for(i, ct_dispatch_task, (void*)tasks, c);
+    ct_for_at(0, CT_CALLER(), i, ct_dispatch_task, (void*)tasks, c);
 }
 
 typedef struct {
@@ -151,7 +249,38 @@ void ct_verbose_ind_func(int index, void* context) {
     wc->next_func(index, wc->next_context);
 }
 
-void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+/* counts the indexes, and gives the loops spawned by an index their depth */
+typedef struct {
+    ct_ind_func next_func;
+    void* next_context;
+    int depth;
+} ct_stats_func_context;
+
+void ct_stats_ind_func(int index, void* context) {
+    ct_stats_func_context* sc = (ct_stats_func_context*)context;
+    ct_stats_slot* slot = ct_stats_lock_slot();
+    int depth = slot->depth;
+    slot->indexes++;
+    ct_stats_unlock_slot(slot);
+    if(slot->shared) {
+        sc->next_func(index, sc->next_context);
+        return;
+    }
+    slot->depth = sc->depth;
+    sc->next_func(index, sc->next_context);
+    slot->depth = depth;
+}
+
+void ct_for_at(const char* name, const void* caller, int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_stats_func_context sc;
+    ct_perf_func_context pc;
+    ct_perf_chunk chunk;
+    ct_imbalance_func_context ic;
+    ct_stats_slot* slot = 0;
+    ct_stats_site* site = 0;
+    ct_ind_func index_func = f; /* before wrapping */
+    double start = 0;
+    char buf[CT_SITE_NAME_SIZE];
     if(c == 0) {
         c = g_ct_default_canceller;
     }
@@ -160,10 +289,48 @@ void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
             return;
         }
     }
+    if(g_ct_imbalance) {
+        ct_imbalance_begin(&ic, &f, &context);
+    }
+    if(g_ct_perf_counters) {
+        pc.next_func = f;
+        pc.next_context = context;
+        pc.name = name;
+        pc.caller = caller;
+        f = ct_perf_ind_func;
+        context = &pc;
+    }
+    if(g_ct_stats) {
+        slot = ct_stats_lock_slot();
+        slot->loops++;
+        sc.next_func = f;
+        sc.next_context = context;
+        sc.depth = slot->depth + 1;
+        if(sc.depth > slot->max_depth) {
+            slot->max_depth = sc.depth;
+        }
+        f = ct_stats_ind_func;
+        context = &sc;
+        site = ct_stats_site_of(slot, name, caller);
+        ct_stats_unlock_slot(slot);
+        start = ct_curr_sec();
+    }
+    CT_PROBE3(loop_begin, n, (size_t)index_func, name);
+    if(g_ct_trace) {
+        ct_trace_loop_begin(n, name, caller);
+    }
+    if(g_ct_hooks) {
+        g_ct_hooks->loop_begin(g_ct_hooks->user, ct_worker_id(), name, caller, n);
+    }
+    if(g_ct_pimpl->imp_loop_site) {
+        g_ct_pimpl->imp_loop_site(name, caller);
+    }
+    if(g_ct_perf_counters && !g_ct_pimpl->imp_worker_id) {
+        ct_perf_chunk_begin(&chunk); /* a single worker runs the loop in one chunk */
+    }
     if(g_ct_verbose>0) {
-        /* TODO: add task name */
         ct_wrapped_func_context wc;
-        printf("checkedthreads: ct_for(%d) entered\n",n);
+        printf("checkedthreads: ct_for(%d) entered: %s\n",n,ct_site_name(name,caller,buf));
         if(g_ct_verbose>1) {
             wc.next_func = f;
             wc.next_context = context;
@@ -171,9 +338,38 @@ void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
             context = &wc;
         }
         g_ct_pimpl->imp_for(n, f, context, c);
-        printf("checkedthreads: ct_for(%d) ended\n",n);
+        printf("checkedthreads: ct_for(%d) ended: %s\n",n,ct_site_name(name,caller,buf));
     }
     else {
         g_ct_pimpl->imp_for(n, f, context, c);
     }
+    if(g_ct_perf_counters && !g_ct_pimpl->imp_worker_id) {
+        ct_perf_chunk_end(&chunk);
+    }
+    if(g_ct_hooks) {
+        g_ct_hooks->loop_end(g_ct_hooks->user, ct_worker_id());
+    }
+    if(g_ct_trace) {
+        ct_trace(CT_TRACE_LOOP_END, 0);
+    }
+    CT_PROBE3(loop_end, n, (size_t)index_func, name);
+    if(g_ct_imbalance) {
+        ct_imbalance_end(&ic, n, name, caller);
+    }
+    if(site) {
+        double time = ct_curr_sec() - start;
+        slot = ct_stats_lock_slot();
+        site->loops++;
+        site->indexes += n;
+        site->time += time;
+        ct_stats_unlock_slot(slot);
+    }
+}
+
+void ct_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_for_at(0, CT_CALLER(), n, f, context, c);
+}
+
+void ct_for_named(const char* name, int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_for_at(name, CT_CALLER(), n, f, context, c);
 }
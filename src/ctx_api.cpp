@@ -1,4 +1,4 @@
-#include "checkedthreads.h"
+#include "imp.h"
 #include <cstdlib>
 #include <cstring>
 
@@ -8,7 +8,11 @@ void ctx_for_ind_func(int ind, void* context) {
 }
 
 void ctx_for(int n, const ctx_ind_func& f, ct_canceller* c) {
-    ct_for(n, ctx_for_ind_func, (void*)&f, c);
+    ct_for_at(0, CT_CALLER(), n, ctx_for_ind_func, (void*)&f, c);
+}
+
+void ctx_for(const char* name, int n, const ctx_ind_func& f, ct_canceller* c) {
+    ct_for_at(name, CT_CALLER(), n, ctx_for_ind_func, (void*)&f, c);
 }
 
 void ctx_invoke_ind_func(int ind, void* context) {
@@ -41,7 +45,7 @@ void ctx_invoke_(ctx_task_node_* head, ct_canceller* c) {
         ++n;
     }
 
-    ct_for(n, ctx_invoke_ind_func, tasks, c);
+    ct_for_at(0, CT_CALLER(), n, ctx_invoke_ind_func, tasks, c);
 
     if(tasks != local_tasks) {
         free(tasks);
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "imbalance.h"
+#include "clock.h"
+#include "atomic.h"
+
+/* loops faster than this aren't worth warning about */
+#define CT_IMBALANCE_MIN_SEC 0.001
+/* warnings after these many are suppressed */
+#define CT_IMBALANCE_MAX_WARNINGS 10
+
+double g_ct_imbalance;
+volatile int g_ct_imbalance_warnings;
+
+extern ct_imp* g_ct_pimpl;
+
+void ct_imbalance_init(const ct_env_var* env) {
+    g_ct_imbalance = atof(ct_getenv(env, "CT_IMBALANCE", "0"));
+    /* with a single worker, every loop is "imbalanced" */
+    if(!g_ct_pimpl->imp_worker_id || g_ct_num_workers < 2) {
+        g_ct_imbalance = 0;
+    }
+}
+
+void ct_imbalance_ind_func(int index, void* context) {
+    ct_imbalance_func_context* ic = (ct_imbalance_func_context*)context;
+    int worker = ct_worker_id();
+    ct_imbalance_worker* w = &ic->workers[worker];
+    double start = ct_curr_sec(), time;
+    int i;
+    ic->next_func(index, ic->next_context);
+    time = ct_curr_sec() - start;
+    ct_lock_worker(worker);
+    w->time += time;
+    w->indexes++;
+    /* insert into the heaviest indexes */
+    for(i=CT_IMBALANCE_HEAVY; i>0 && (w->heavy_time[i-1] < time || w->heavy[i-1] < 0); --i) {
+        if(i < CT_IMBALANCE_HEAVY) {
+            w->heavy[i] = w->heavy[i-1];
+            w->heavy_time[i] = w->heavy_time[i-1];
+        }
+    }
+    if(i < CT_IMBALANCE_HEAVY) {
+        w->heavy[i] = index;
+        w->heavy_time[i] = time;
+    }
+    ct_unlock_worker(worker);
+}
+
+void ct_imbalance_begin(ct_imbalance_func_context* ic, ct_ind_func* f, void** context) {
+    int i, j;
+    ic->next_func = *f;
+    ic->next_context = *context;
+    ic->workers = (ct_imbalance_worker*)calloc(g_ct_num_workers+1, sizeof(ct_imbalance_worker));
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        for(j=0; j<CT_IMBALANCE_HEAVY; ++j) {
+            ic->workers[i].heavy[j] = -1;
+        }
+    }
+    *f = ct_imbalance_ind_func;
+    *context = ic;
+}
+
+void ct_imbalance_warn(const ct_imbalance_func_context* ic, int n, int participants,
+                       const ct_imbalance_worker* slowest, double mean, const char* name, const void* caller) {
+    int heavy[CT_IMBALANCE_HEAVY];
+    double heavy_time[CT_IMBALANCE_HEAVY];
+    int i, j, k, warning = ATOMIC_FETCH_THEN_INCR(&g_ct_imbalance_warnings, 1);
+    char buf[CT_SITE_NAME_SIZE];
+    if(warning >= CT_IMBALANCE_MAX_WARNINGS) {
+        if(warning == CT_IMBALANCE_MAX_WARNINGS) {
+            printf("checkedthreads - WARNING: further $CT_IMBALANCE warnings suppressed\n");
+        }
+        return;
+    }
+    /* the heaviest indexes of all the workers */
+    for(k=0; k<CT_IMBALANCE_HEAVY; ++k) {
+        heavy[k] = -1;
+        heavy_time[k] = 0;
+    }
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        for(j=0; j<CT_IMBALANCE_HEAVY && ic->workers[i].heavy[j] >= 0; ++j) {
+            double time = ic->workers[i].heavy_time[j];
+            for(k=CT_IMBALANCE_HEAVY; k>0 && (heavy[k-1] < 0 || heavy_time[k-1] < time); --k) {
+                if(k < CT_IMBALANCE_HEAVY) {
+                    heavy[k] = heavy[k-1];
+                    heavy_time[k] = heavy_time[k-1];
+                }
+            }
+            if(k < CT_IMBALANCE_HEAVY) {
+                heavy[k] = ic->workers[i].heavy[j];
+                heavy_time[k] = time;
+            }
+        }
+    }
+    printf("checkedthreads - WARNING: imbalanced loop %s: %d indexes, the busiest worker ran %d of them "
+           "for %.3f s, %.1f times the mean of %.3f s over %d workers; heaviest indexes:",
+           ct_site_name(name, caller, buf), n, slowest->indexes, slowest->time,
+           slowest->time / mean, mean, participants);
+    /* leaving out indexes much lighter than the heaviest */
+    for(k=0; k<CT_IMBALANCE_HEAVY && heavy[k] >= 0 && heavy_time[k] * 10 >= heavy_time[0]; ++k) {
+        printf("%s %d (%.3f s)", k ? "," : "", heavy[k], heavy_time[k]);
+    }
+    printf("\n");
+    if(n < g_ct_num_workers) {
+        printf("checkedthreads - WARNING: ...the loop has fewer indexes than the %d workers; "
+               "split its work into more indexes\n", g_ct_num_workers);
+    }
+    else if(heavy_time[0] > mean) {
+        printf("checkedthreads - WARNING: ...index %d alone ran longer than a worker's even share; "
+               "split heavy indexes into finer ones, or parallelize their work with a nested loop\n", heavy[0]);
+    }
+    else {
+        printf("checkedthreads - WARNING: ...no single index is heavier than an even share; "
+               "a finer grain (more, smaller indexes) lets idle workers take over more of the work\n");
+    }
+}
+
+void ct_imbalance_end(ct_imbalance_func_context* ic, int n, const char* name, const void* caller) {
+    int participants = n < g_ct_num_workers ? n : g_ct_num_workers;
+    const ct_imbalance_worker* slowest = &ic->workers[0];
+    double total = 0, mean;
+    int i;
+    for(i=0; i<=g_ct_num_workers; ++i) { /* threads without a worker ID count as one more */
+        total += ic->workers[i].time;
+        if(ic->workers[i].time > slowest->time) {
+            slowest = &ic->workers[i];
+        }
+    }
+    mean = participants > 0 ? total / participants : 0;
+    if(slowest->time >= CT_IMBALANCE_MIN_SEC && slowest->time > g_ct_imbalance * mean) {
+        ct_imbalance_warn(ic, n, participants, slowest, mean, name, caller);
+    }
+    free(ic->workers);
+}
@@ -0,0 +1,33 @@
+#ifndef CT_IMBALANCE_H_
+#define CT_IMBALANCE_H_
+
+#include "imp.h"
+
+/* $CT_IMBALANCE: parallel schedulers time every index, and warn about loops
+   where the busiest worker ran longer than the given multiple of the mean
+   over the workers the loop could keep busy. */
+#define CT_IMBALANCE_HEAVY 3 /* the heaviest indexes kept per worker */
+
+typedef struct {
+    double time; /* in the loop's indexes */
+    int indexes;
+    int heavy[CT_IMBALANCE_HEAVY]; /* the heaviest indexes, heaviest first */
+    double heavy_time[CT_IMBALANCE_HEAVY];
+    char pad[64]; /* workers time indexes concurrently */
+} ct_imbalance_worker;
+
+typedef struct {
+    ct_ind_func next_func;
+    void* next_context;
+    ct_imbalance_worker* workers; /* g_ct_num_workers+1 of them (see ct_lock_worker) */
+} ct_imbalance_func_context;
+
+extern double g_ct_imbalance; /* the threshold; 0 if $CT_IMBALANCE is unset */
+
+void ct_imbalance_init(const ct_env_var* env);
+/* starts timing the loop's indexes, wrapping f and context in ic */
+void ct_imbalance_begin(ct_imbalance_func_context* ic, ct_ind_func* f, void** context);
+/* warns if the loop was imbalanced */
+void ct_imbalance_end(ct_imbalance_func_context* ic, int n, const char* name, const void* caller);
+
+#endif
@@ -2,6 +2,7 @@
 #define CT_IMP_H_
 
 #include "checkedthreads.h"
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +24,11 @@ typedef void (*ct_imp_for_func)(int n, ct_ind_func f, void* context, ct_cancelle
 typedef void (*ct_imp_canceller_init_func)(ct_canceller* c);
 typedef void (*ct_imp_canceller_fini_func)(ct_canceller* c);
 typedef void (*ct_imp_cancel_func)(ct_canceller* c);
+/* a worker ID in [0,$CT_THREADS) for the scheduler's threads, or -1 for
+   other threads; used for per-worker statistics ($CT_STATS) */
+typedef int (*ct_imp_worker_id_func)(void);
+/* the site (see ct_site_name) of the loop the calling thread passes to imp_for next */
+typedef void (*ct_imp_loop_site_func)(const char* name, const void* caller);
 
 typedef struct {
     const char* name;
@@ -32,10 +38,41 @@ typedef struct {
     ct_imp_canceller_init_func imp_canceller_init; /* may be 0 */
     ct_imp_canceller_fini_func imp_canceller_fini; /* may be 0 */
     ct_imp_cancel_func imp_cancel; /* may be 0 */
+    ct_imp_worker_id_func imp_worker_id; /* may be 0 if there's a single worker */
+    ct_imp_loop_site_func imp_loop_site; /* may be 0 */
 } ct_imp;
 
 const char* ct_getenv(const ct_env_var* env, const char* name, const char* default_value);
 
+extern int g_ct_verbose; /* $CT_VERBOSE */
+
+/* per-worker data ($CT_STATS, $CT_TRACE) is kept in g_ct_num_workers+1 slots,
+   indexed by ct_worker_id. a scheduler without imp_worker_id has a single
+   worker, 0. threads with IDs out of [0,g_ct_num_workers) share the last slot,
+   which is only updated between ct_lock_worker and ct_unlock_worker (these
+   do nothing for the other slots, each updated by its worker alone) */
+extern int g_ct_num_workers;
+int ct_worker_id(void);
+void ct_lock_worker(int worker);
+void ct_unlock_worker(int worker);
+
+/* a loop is identified in verbose output, statistics and traces by its name
+   (a static string given to ct_for_named, stored by pointer) or else by the
+   address ct_for was called from */
+#ifdef __GNUC__
+#define CT_CALLER() __builtin_return_address(0)
+#else
+#define CT_CALLER() 0
+#endif
+void ct_for_at(const char* name, const void* caller, int n, ct_ind_func f, void* context, ct_canceller* c);
+/* the name, or the caller's address written into buf */
+#define CT_SITE_NAME_SIZE 32
+const char* ct_site_name(const char* name, const void* caller, char buf[CT_SITE_NAME_SIZE]);
+void ct_print_json_string(FILE* f, const char* s);
+
+/* 0 unless ct_set_hooks was called, and then every hook is non-0 */
+extern const ct_hooks* g_ct_hooks;
+
 #ifdef __cplusplus
 }
 #endif
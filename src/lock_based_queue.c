@@ -1,5 +1,7 @@
 #include "lock_based_queue.h"
 #include "atomic.h"
+#include "stats.h"
+#include "probes.h"
 
 void ct_locked_queue_init(ct_locked_queue* q, ct_work_item** work_items, int capacity) {
     pthread_mutex_init(&q->mutex, 0);
@@ -10,13 +12,30 @@ void ct_locked_queue_init(ct_locked_queue* q, ct_work_item** work_items, int cap
     q->size = 0;
 }
 
+void ct_locked_queue_lock(ct_locked_queue* q) {
+    ct_stats_slot* slot;
+    int contended = 0;
+    if(!g_ct_stats) {
+        pthread_mutex_lock(&q->mutex);
+        return;
+    }
+    if(pthread_mutex_trylock(&q->mutex) != 0) {
+        pthread_mutex_lock(&q->mutex);
+        contended = 1;
+    }
+    slot = ct_stats_lock_slot();
+    slot->lock_acquisitions++;
+    slot->lock_contentions += contended;
+    ct_stats_unlock_slot(slot);
+}
+
 int ct_locked_enqueue(ct_locked_queue* q, ct_work_item* item, int reps) {
-    int ret = 0, capacity;
+    int ret = 0, capacity, size;
     /* don't bother to lock if the queue is full */
     if(q->size + reps > q->capacity) {
         return ret;
     }
-    pthread_mutex_lock(&q->mutex);
+    ct_locked_queue_lock(q);
     /* check again if we aren't full, this time under a lock
        (so that if we aren't full, we can count on staying not full
        inside the if) */
@@ -34,17 +53,22 @@ int ct_locked_enqueue(ct_locked_queue* q, ct_work_item* item, int reps) {
         q->size += reps;
         ret = 1;
     }
+    size = q->size;
     pthread_mutex_unlock(&q->mutex);
+    if(ret) {
+        CT_PROBE3(enqueue, item, reps, size);
+    }
     return ret;
 }
 
 ct_work_item* ct_locked_dequeue(ct_locked_queue* q) {
     ct_work_item* ret = 0;
+    int size;
     /* don't bother to lock if the queue is empty */
     if(q->size == 0) {
         return ret;
     }
-    pthread_mutex_lock(&q->mutex);
+    ct_locked_queue_lock(q);
     /* check again if we're empty */
     if(q->size > 0) {
         int r = q->read_ind;
@@ -56,6 +80,10 @@ ct_work_item* ct_locked_dequeue(ct_locked_queue* q) {
         q->read_ind = r;
         q->size -= 1;
     }
+    size = q->size;
     pthread_mutex_unlock(&q->mutex);
+    if(ret) {
+        CT_PROBE2(dequeue, ret, size);
+    }
     return ret;
 }
@@ -24,5 +24,7 @@ void ct_locked_queue_init(ct_locked_queue* q, ct_work_item** work_items, int cap
    so we can wait until that happens (the alternative is dynamic allocation). */
 int ct_locked_enqueue(ct_locked_queue* q, ct_work_item* item, int reps);
 ct_work_item* ct_locked_dequeue(ct_locked_queue* q);
+/* locks the mutex, counting contention with $CT_STATS */
+void ct_locked_queue_lock(ct_locked_queue* q);
 
 #endif
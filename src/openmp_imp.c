@@ -1,7 +1,10 @@
 #include "imp.h"
+#include "perf_counters.h"
 
 #ifdef CT_OPENMP
 
+#include <omp.h>
+
 void ct_openmp_init(const ct_env_var* env) {
     (void)env;
 }
@@ -9,9 +12,51 @@ void ct_openmp_init(const ct_env_var* env) {
 void ct_openmp_fini(void) {
 }
 
+/* the thread's number in the outermost parallel region; nested loops run
+   within the threads of that region (nested parallelism is off by default) */
+int ct_openmp_worker_id(void) {
+    return omp_get_level() > 0 ? omp_get_ancestor_thread_num(1) : 0;
+}
+
+/* with hooks or $CT_PERF_COUNTERS, each thread's share of the loop is a chunk.
+   nowait lets a thread end its chunk without waiting for the others at the barrier. */
+void ct_openmp_for_chunked(int n, ct_ind_func f, void* context, ct_canceller* c) {
+    int cancelled = 0;
+#pragma omp parallel
+    {
+        int i, done = 0;
+        int worker = ct_worker_id();
+        ct_perf_chunk chunk;
+        if(g_ct_hooks) {
+            g_ct_hooks->chunk_begin(g_ct_hooks->user, worker);
+        }
+        if(g_ct_perf_counters) {
+            ct_perf_chunk_begin(&chunk);
+        }
+#pragma omp for schedule(dynamic,1) nowait
+        for(i=0; i<n; ++i) {
+            if(!cancelled && !c->cancelled) {
+              f(i, context);
+              cancelled = c->cancelled;
+              ++done;
+            }
+        }
+        if(g_ct_perf_counters) {
+            ct_perf_chunk_end(&chunk);
+        }
+        if(g_ct_hooks) {
+            g_ct_hooks->chunk_end(g_ct_hooks->user, worker, done);
+        }
+    }
+}
+
 void ct_openmp_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
     int i;
     int cancelled = 0;
+    if(g_ct_hooks || g_ct_perf_counters) {
+        ct_openmp_for_chunked(n, f, context, c);
+        return;
+    }
 #pragma omp parallel for schedule(dynamic,1)
     for(i=0; i<n; ++i) {
         if(!cancelled && !c->cancelled) {
@@ -27,6 +72,8 @@ ct_imp g_ct_openmp_imp = {
     &ct_openmp_fini,
     &ct_openmp_for,
     0, 0, 0, /* cancelling functions */
+    &ct_openmp_worker_id,
+    0, /* loop sites */
 };
 
 #else
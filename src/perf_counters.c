@@ -0,0 +1,347 @@
+#define _GNU_SOURCE /* syscall under -std=c89 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "perf_counters.h"
+#include "atomic.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+typedef struct {
+    const char* name;
+    unsigned long config; /* a PERF_TYPE_HARDWARE event */
+} ct_perf_event;
+
+#ifdef __linux__
+ct_perf_event g_ct_perf_events[] = {
+    {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-references", PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_COUNT_HW_CACHE_MISSES},
+    {"branches", PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES},
+    {"bus-cycles", PERF_COUNT_HW_BUS_CYCLES},
+    {"ref-cycles", PERF_COUNT_HW_REF_CPU_CYCLES},
+    {0, 0}
+};
+#else
+ct_perf_event g_ct_perf_events[] = {{0, 0}};
+#endif
+
+/* a thread's counters, opened the first time it runs indexes, and closed
+   when it exits or at ct_fini */
+typedef struct ct_perf_thread_ {
+    int fds[CT_PERF_MAX_COUNTERS]; /* fds[0], the group leader, is -1 if opening failed */
+    ct_perf_chunk* chunk; /* the innermost chunk the thread is running */
+    struct ct_perf_thread_* next;
+} ct_perf_thread;
+
+int g_ct_perf_counters;
+const ct_perf_event* g_ct_perf_selected[CT_PERF_MAX_COUNTERS];
+ct_perf_worker* g_ct_perf_workers;
+pthread_key_t g_ct_perf_thread_key;
+pthread_mutex_t g_ct_perf_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+ct_perf_thread* g_ct_perf_threads; /* all the threads' counters, for ct_fini to close */
+volatile int g_ct_perf_failed; /* the number of threads which couldn't open their counters */
+
+/* opens a group of the selected counters for the calling thread;
+   returns 0 (with fds[0] = -1) if perf events aren't available */
+int ct_perf_open(int fds[CT_PERF_MAX_COUNTERS]) {
+#ifdef __linux__
+    int i, group_fd = -1;
+    for(i=0; i<g_ct_perf_counters; ++i) {
+        struct perf_event_attr attr;
+        int fd;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = g_ct_perf_selected[i]->config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1; /* permitted at perf_event_paranoid 2 */
+        attr.exclude_hv = 1;
+        /* this thread, on any CPU */
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+        if(fd < 0) {
+            while(i--) {
+                close(fds[i]);
+            }
+            fds[0] = -1;
+            return 0;
+        }
+        fds[i] = fd;
+        if(group_fd < 0) {
+            group_fd = fd;
+        }
+    }
+    return 1;
+#else
+    fds[0] = -1;
+    return 0;
+#endif
+}
+
+/* the counters, in the order of g_ct_perf_selected, then the time the group
+   was enabled and the time it was running; returns 0 on failure */
+int ct_perf_read(int group_fd, double counts[CT_PERF_MAX_COUNTERS+2]) {
+#ifdef __linux__
+    /* the number of counters, the times enabled and running, then the values */
+    uint64_t values[CT_PERF_MAX_COUNTERS+3];
+    int i;
+    if(read(group_fd, values, sizeof(uint64_t)*(g_ct_perf_counters+3)) <= 0) {
+        return 0;
+    }
+    for(i=0; i<g_ct_perf_counters; ++i) {
+        counts[i] = (double)values[i+3];
+    }
+    counts[g_ct_perf_counters] = (double)values[1];
+    counts[g_ct_perf_counters+1] = (double)values[2];
+    return 1;
+#else
+    (void)group_fd; (void)counts;
+    return 0;
+#endif
+}
+
+void ct_perf_close_fds(int fds[CT_PERF_MAX_COUNTERS]) {
+#ifdef __linux__
+    int c;
+    if(fds[0] >= 0) {
+        for(c=0; c<g_ct_perf_counters; ++c) {
+            close(fds[c]);
+        }
+    }
+#else
+    (void)fds;
+#endif
+}
+
+void ct_perf_close(void* thread) {
+    ct_perf_thread* t = (ct_perf_thread*)thread;
+    ct_perf_close_fds(t->fds);
+    free(t);
+}
+
+/* the key's destructor, called when a thread exits - unless ct_fini
+   closed its counters first */
+void ct_perf_thread_exit(void* thread) {
+    ct_perf_thread** p;
+    pthread_mutex_lock(&g_ct_perf_threads_mutex);
+    for(p = &g_ct_perf_threads; *p && *p != thread; p = &(*p)->next);
+    if(*p) {
+        *p = (*p)->next;
+        ct_perf_close(thread);
+    }
+    pthread_mutex_unlock(&g_ct_perf_threads_mutex);
+}
+
+ct_perf_thread* ct_perf_thread_of(void) {
+    ct_perf_thread* t = (ct_perf_thread*)pthread_getspecific(g_ct_perf_thread_key);
+    if(!t) {
+        t = (ct_perf_thread*)calloc(1, sizeof(ct_perf_thread));
+        if(!ct_perf_open(t->fds)) {
+            ATOMIC_FETCH_THEN_INCR(&g_ct_perf_failed, 1);
+        }
+        pthread_mutex_lock(&g_ct_perf_threads_mutex);
+        t->next = g_ct_perf_threads;
+        g_ct_perf_threads = t;
+        pthread_mutex_unlock(&g_ct_perf_threads_mutex);
+        pthread_setspecific(g_ct_perf_thread_key, t);
+    }
+    return t;
+}
+
+void ct_perf_init(const ct_env_var* env) {
+    char names[256];
+    char* name;
+    int fds[CT_PERF_MAX_COUNTERS];
+    strncpy(names, ct_getenv(env, "CT_PERF_COUNTERS", ""), sizeof names - 1);
+    names[sizeof names - 1] = 0;
+    g_ct_perf_counters = 0;
+    for(name = strtok(names, ","); name; name = strtok(0, ",")) {
+        const ct_perf_event* e;
+        for(e = g_ct_perf_events; e->name && strcmp(e->name, name) != 0; ++e);
+        if(!e->name) {
+            printf("checkedthreads - WARNING: unknown $CT_PERF_COUNTERS event %s ignored\n", name);
+        }
+        else if(g_ct_perf_counters < CT_PERF_MAX_COUNTERS) {
+            g_ct_perf_selected[g_ct_perf_counters++] = e;
+        }
+    }
+    if(!g_ct_perf_counters) {
+        return;
+    }
+    /* find out if we're permitted to count before any worker is spawned */
+    if(!ct_perf_open(fds)) {
+        printf("checkedthreads - WARNING: can't open performance counters for $CT_PERF_COUNTERS "
+               "(not permitted, or not supported) - not counting\n");
+        g_ct_perf_counters = 0;
+        return;
+    }
+    ct_perf_close_fds(fds); /* each thread opens its own */
+    g_ct_perf_failed = 0;
+    g_ct_perf_workers = (ct_perf_worker*)calloc(g_ct_num_workers+1, sizeof(ct_perf_worker));
+    pthread_key_create(&g_ct_perf_thread_key, ct_perf_thread_exit);
+}
+
+void ct_perf_worker_start(void) {
+    if(g_ct_perf_counters) {
+        ct_perf_thread_of();
+    }
+}
+
+ct_perf_site* ct_perf_site_of(ct_perf_worker* w, const char* name, const void* caller) {
+    size_t key = (size_t)(name ? (const void*)name : caller);
+    int i, h = (int)((key >> 4) % CT_PERF_SITES);
+    for(i=0; i<CT_PERF_SITES; ++i) {
+        ct_perf_site* site = &w->sites[(h + i) % CT_PERF_SITES];
+        if(!site->name && !site->caller) {
+            site->name = name;
+            site->caller = caller;
+            return site;
+        }
+        if(site->name == name && (name || site->caller == caller)) {
+            return site;
+        }
+    }
+    return 0;
+}
+
+void ct_perf_chunk_begin(ct_perf_chunk* chunk) {
+    ct_perf_thread* t = ct_perf_thread_of();
+    chunk->loop = 0;
+    chunk->indexes = 0;
+    chunk->outer = t->chunk;
+    chunk->counting = t->fds[0] >= 0 && ct_perf_read(t->fds[0], chunk->before);
+    t->chunk = chunk;
+}
+
+/* with more counters than the PMU has, the kernel multiplexes them, and the
+   counts are scaled up by the time the group was enabled over the time it ran */
+void ct_perf_chunk_end(ct_perf_chunk* chunk) {
+    ct_perf_thread* t = ct_perf_thread_of();
+    double after[CT_PERF_MAX_COUNTERS+2], enabled, running, scale;
+    int worker, i;
+    ct_perf_site* site;
+    t->chunk = chunk->outer;
+    if(!chunk->loop || !chunk->counting || !ct_perf_read(t->fds[0], after)) {
+        return;
+    }
+    enabled = after[g_ct_perf_counters] - chunk->before[g_ct_perf_counters];
+    running = after[g_ct_perf_counters+1] - chunk->before[g_ct_perf_counters+1];
+    scale = running > 0 ? enabled / running : 1;
+    worker = ct_worker_id();
+    ct_lock_worker(worker);
+    site = ct_perf_site_of(&g_ct_perf_workers[worker], chunk->name, chunk->caller);
+    if(site) {
+        site->indexes += chunk->indexes;
+        for(i=0; i<g_ct_perf_counters; ++i) {
+            site->counts[i] += (after[i] - chunk->before[i]) * scale;
+        }
+    }
+    ct_unlock_worker(worker);
+}
+
+void ct_perf_ind_func(int index, void* context) {
+    ct_perf_func_context* pc = (ct_perf_func_context*)context;
+    ct_perf_chunk* chunk = ct_perf_thread_of()->chunk;
+    ct_perf_chunk own;
+    if(!chunk || (chunk->loop && chunk->loop != pc)) {
+        /* not run in a chunk of its loop - say, by a spawner with the queue full */
+        chunk = &own;
+        ct_perf_chunk_begin(chunk);
+    }
+    if(!chunk->loop) {
+        chunk->loop = pc;
+        chunk->name = pc->name;
+        chunk->caller = pc->caller;
+    }
+    chunk->indexes++;
+    pc->next_func(index, pc->next_context);
+    if(chunk == &own) {
+        ct_perf_chunk_end(chunk);
+    }
+}
+
+int ct_perf_same_site(const ct_perf_site* a, const ct_perf_site* b) {
+    if(a->name || b->name) {
+        return a->name && b->name && strcmp(a->name, b->name) == 0;
+    }
+    return a->caller == b->caller;
+}
+
+int ct_perf_counter(const char* name) {
+    int i;
+    for(i=0; i<g_ct_perf_counters; ++i) {
+        if(strcmp(g_ct_perf_selected[i]->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ct_perf_print(void) {
+    ct_perf_site* sites = (ct_perf_site*)malloc(sizeof(ct_perf_site)*CT_PERF_SITES*(g_ct_num_workers+1));
+    int num_sites = 0, i, j, k, c;
+    int cycles = ct_perf_counter("cycles"), instructions = ct_perf_counter("instructions");
+    char buf[CT_SITE_NAME_SIZE];
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        for(j=0; j<CT_PERF_SITES; ++j) {
+            const ct_perf_site* site = &g_ct_perf_workers[i].sites[j];
+            if(!site->indexes) {
+                continue;
+            }
+            for(k=0; k<num_sites && !ct_perf_same_site(&sites[k], site); ++k);
+            if(k == num_sites) {
+                sites[num_sites++] = *site;
+            }
+            else {
+                sites[k].indexes += site->indexes;
+                for(c=0; c<g_ct_perf_counters; ++c) {
+                    sites[k].counts[c] += site->counts[c];
+                }
+            }
+        }
+    }
+    if(g_ct_perf_failed) {
+        printf("checkedthreads: perf: %d threads couldn't open their counters; their indexes aren't counted\n",
+               g_ct_perf_failed);
+    }
+    for(i=0; i<num_sites; ++i) {
+        const ct_perf_site* s = &sites[i];
+        printf("checkedthreads: perf: loop %s: %lu indexes", ct_site_name(s->name, s->caller, buf), s->indexes);
+        if(cycles >= 0 && instructions >= 0) {
+            printf(", IPC %.2f", s->counts[cycles] > 0 ? s->counts[instructions] / s->counts[cycles] : 0.);
+        }
+        for(j=0; j<g_ct_perf_counters; ++j) {
+            printf(", %s %.0f (%.1f per index)", g_ct_perf_selected[j]->name, s->counts[j], s->counts[j] / s->indexes);
+        }
+        printf("\n");
+    }
+    free(sites);
+}
+
+void ct_perf_fini(void) {
+    ct_perf_thread* t;
+    if(!g_ct_perf_counters) {
+        return;
+    }
+    ct_perf_print();
+    pthread_mutex_lock(&g_ct_perf_threads_mutex);
+    while(g_ct_perf_threads) {
+        t = g_ct_perf_threads;
+        g_ct_perf_threads = t->next;
+        ct_perf_close(t);
+    }
+    pthread_setspecific(g_ct_perf_thread_key, 0);
+    pthread_key_delete(g_ct_perf_thread_key);
+    pthread_mutex_unlock(&g_ct_perf_threads_mutex);
+    free(g_ct_perf_workers);
+    g_ct_perf_counters = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef CT_PERF_COUNTERS_H_
+#define CT_PERF_COUNTERS_H_
+
+#include "imp.h"
+
+/* $CT_PERF_COUNTERS: hardware counters (read with perf_event_open on Linux)
+   around every chunk - a thread's run of some of a loop's indexes, or the
+   whole loop with a single-worker scheduler - summed per loop site by every
+   worker in a table of its own, and printed at ct_fini. a loop's counts
+   include its nested loops. */
+#define CT_PERF_MAX_COUNTERS 8
+#define CT_PERF_SITES 64
+
+typedef struct {
+    const char* name;
+    const void* caller;
+    unsigned long indexes;
+    double counts[CT_PERF_MAX_COUNTERS];
+} ct_perf_site;
+
+/* threads without a worker ID share one more table (see ct_lock_worker) */
+typedef struct {
+    ct_perf_site sites[CT_PERF_SITES]; /* a hash table */
+    char pad[64];
+} ct_perf_worker;
+
+typedef struct {
+    ct_ind_func next_func;
+    void* next_context;
+    const char* name;
+    const void* caller;
+} ct_perf_func_context;
+
+/* the counters are read when a chunk begins and ends; the counts of a chunk
+   nested in it (one of a nested loop) are included */
+typedef struct ct_perf_chunk_ {
+    double before[CT_PERF_MAX_COUNTERS+2]; /* the counters, then the time enabled and running */
+    int counting; /* 0 if the thread's counters couldn't be read */
+    const ct_perf_func_context* loop; /* of the indexes run in the chunk, 0 until the first one */
+    const char* name; /* the loop's site */
+    const void* caller;
+    unsigned long indexes;
+    struct ct_perf_chunk_* outer; /* the chunk the thread was running before this one */
+} ct_perf_chunk;
+
+extern int g_ct_perf_counters; /* the number of counters, 0 if $CT_PERF_COUNTERS is unset */
+
+void ct_perf_init(const ct_env_var* env);
+void ct_perf_fini(void);
+/* opens the calling thread's counters; done on demand if not called */
+void ct_perf_worker_start(void);
+/* called around chunks by schedulers with several workers, and around
+   loops by ct_for otherwise; indexes run outside a chunk of their loop
+   are counted one by one */
+void ct_perf_chunk_begin(ct_perf_chunk* chunk);
+void ct_perf_chunk_end(ct_perf_chunk* chunk);
+/* runs the index with a ct_perf_func_context, counting it in its chunk */
+void ct_perf_ind_func(int index, void* context);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CT_PROBES_H_
+#define CT_PROBES_H_
+
+#include "checkedthreads.h"
+
+/* USDT probes of provider "checkedthreads" for perf and bpftrace, enabled
+   by #define CT_USDT in checkedthreads_config.h. a probe is a nop until
+   a tracer attaches to it. (fixed-arity macros since C89 lacks variadic ones) */
+#ifdef CT_USDT
+#include <sys/sdt.h>
+#define CT_PROBE1(name, a) DTRACE_PROBE1(checkedthreads, name, a)
+#define CT_PROBE2(name, a, b) DTRACE_PROBE2(checkedthreads, name, a, b)
+#define CT_PROBE3(name, a, b, c) DTRACE_PROBE3(checkedthreads, name, a, b, c)
+#else
+#define CT_PROBE1(name, a)
+#define CT_PROBE2(name, a, b)
+#define CT_PROBE3(name, a, b, c)
+#endif
+
+#endif
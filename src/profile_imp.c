@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "imp.h"
+#include "clock.h"
+
+/* profile: a serial run timing the serial segments between the points where
+   loops fork and join, to find the work (the total time) and the span (the
+   critical path - the time with infinitely many processors) of the program
+   and of every loop, like Cilkview. a loop's work is the sum of its iterations'
+   work, and its span is its longest iteration's span; the work and the span of
+   an iteration (or of the program outside loops) add up its serial segments
+   and the loops it runs, one after another. */
+
+typedef struct ct_profile_loop_ {
+    /* loops with the same parent are told apart by their site - ctx_for's
+       loops all have the same f */
+    const char* name;
+    const void* caller;
+    struct ct_profile_loop_* parent;
+    struct ct_profile_loop_* children; /* in the order of first entry */
+    struct ct_profile_loop_* next_sibling;
+    long runs;
+    long iters;
+    double work, span; /* summed over the runs */
+} ct_profile_loop;
+
+/* the running strand - an iteration, or the program outside loops */
+typedef struct {
+    double work, span;
+    double seg_start;
+} ct_profile_strand;
+
+ct_profile_loop g_ct_profile_root; /* the program */
+ct_profile_loop* g_ct_profile_loop;
+ct_profile_strand g_ct_profile_main;
+ct_profile_strand* g_ct_profile_strand;
+double g_ct_profile_overhead; /* the time of a clock read, taken out of every segment */
+const char* g_ct_profile_site_name; /* the site of the loop entered next */
+const void* g_ct_profile_site_caller;
+
+void ct_profile_init(const ct_env_var* env) {
+    int i;
+    double start;
+    (void)env;
+    start = ct_curr_sec();
+    for(i=0; i<1000; ++i) {
+        ct_curr_sec();
+    }
+    g_ct_profile_overhead = (ct_curr_sec() - start) / 1001;
+    g_ct_profile_loop = &g_ct_profile_root;
+    g_ct_profile_strand = &g_ct_profile_main;
+    g_ct_profile_main.work = g_ct_profile_main.span = 0;
+    g_ct_profile_main.seg_start = ct_curr_sec();
+}
+
+void ct_profile_end_segment(ct_profile_strand* s) {
+    double time = ct_curr_sec() - s->seg_start - g_ct_profile_overhead;
+    if(time > 0) {
+        s->work += time;
+        s->span += time;
+    }
+}
+
+void ct_profile_loop_site(const char* name, const void* caller) {
+    g_ct_profile_site_name = name;
+    g_ct_profile_site_caller = caller;
+}
+
+/* named sites are keyed by the name, unnamed ones by the caller */
+ct_profile_loop* ct_profile_child(ct_profile_loop* parent, const char* name, const void* caller) {
+    ct_profile_loop** p = &parent->children;
+    while(*p) {
+        if((*p)->name == name && (name || (*p)->caller == caller)) {
+            return *p;
+        }
+        p = &(*p)->next_sibling;
+    }
+    *p = (ct_profile_loop*)calloc(1, sizeof(ct_profile_loop));
+    (*p)->name = name;
+    (*p)->caller = caller;
+    (*p)->parent = parent;
+    return *p;
+}
+
+void ct_profile_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_profile_strand* spawner = g_ct_profile_strand;
+    ct_profile_loop* loop = ct_profile_child(g_ct_profile_loop, g_ct_profile_site_name, g_ct_profile_site_caller);
+    ct_profile_strand iter;
+    double work = 0, span = 0;
+    int i;
+    ct_profile_end_segment(spawner);
+    g_ct_profile_loop = loop;
+    g_ct_profile_strand = &iter;
+    for(i=0; i<n; ++i) {
+        if(c->cancelled) {
+            break;
+        }
+        iter.work = iter.span = 0;
+        iter.seg_start = ct_curr_sec();
+        f(i, context);
+        ct_profile_end_segment(&iter);
+        work += iter.work;
+        if(iter.span > span) {
+            span = iter.span;
+        }
+        loop->iters++;
+    }
+    loop->runs++;
+    loop->work += work;
+    loop->span += span;
+    spawner->work += work;
+    spawner->span += span;
+    g_ct_profile_loop = loop->parent;
+    g_ct_profile_strand = spawner;
+    spawner->seg_start = ct_curr_sec();
+}
+
+/* loops are named by their path in the loop tree - 1.2 is the second loop
+   entered from the first top-level loop */
+void ct_profile_print_loops(ct_profile_loop* parent, char* name, int len, double total_work) {
+    ct_profile_loop* loop;
+    int k = 1;
+    for(loop = parent->children; loop; loop = loop->next_sibling, ++k) {
+        int n = sprintf(name + len, len ? ".%d" : "%d", k);
+        printf("  %8ld %12ld %12.6f %12.6f %11.2f %6.1f  loop %s\n",
+               loop->runs, loop->iters, loop->work, loop->span,
+               loop->span > 0 ? loop->work / loop->span : 0.,
+               total_work > 0 ? 100 * loop->work / total_work : 0., name);
+        if(len + n + 12 < 256) { /* deeper loops are left out */
+            ct_profile_print_loops(loop, name, len + n, total_work);
+        }
+        name[len] = 0;
+    }
+}
+
+void ct_profile_free_loops(ct_profile_loop* parent) {
+    ct_profile_loop* loop = parent->children;
+    while(loop) {
+        ct_profile_loop* next = loop->next_sibling;
+        ct_profile_free_loops(loop);
+        free(loop);
+        loop = next;
+    }
+    parent->children = 0;
+}
+
+void ct_profile_fini(void) {
+    double work, span;
+    char name[256] = "";
+    int p;
+    ct_profile_end_segment(&g_ct_profile_main);
+    work = g_ct_profile_main.work;
+    span = g_ct_profile_main.span;
+    printf("checkedthreads: profile: work %.6f s, span %.6f s, parallelism %.2f\n",
+           work, span, span > 0 ? work / span : 0.);
+    /* Brent's bound: a greedy scheduler runs in at most T1/P + Tinf (and at most T1) */
+    printf("checkedthreads: predicted speedup under greedy scheduling - at least T1/(T1/P+Tinf), at most min(P,T1/Tinf):\n");
+    printf("  %8s %10s %10s\n", "P", "at least", "at most");
+    for(p=2; p<=256; p*=2) {
+        double lower = work > 0 ? work / (work / p + span) : 1.;
+        double upper = span > 0 && work / span < p ? work / span : p;
+        printf("  %8d %10.2f %10.2f\n", p, lower > 1 ? lower : 1., upper);
+    }
+    printf("checkedthreads: loops (work and span summed over their runs; each loop's work includes its nested loops):\n");
+    printf("  %8s %12s %12s %12s %11s %6s\n", "runs", "iterations", "work(s)", "span(s)", "parallelism", "%work");
+    ct_profile_print_loops(&g_ct_profile_root, name, 0, work);
+    ct_profile_free_loops(&g_ct_profile_root);
+}
+
+ct_imp g_ct_profile_imp = {
+    "profile",
+    &ct_profile_init,
+    &ct_profile_fini,
+    &ct_profile_for,
+    0, 0, 0, /* cancelling functions */
+    0, /* a single worker */
+    &ct_profile_loop_site,
+};
@@ -1,11 +1,16 @@
 #include "imp.h"
 #include "nprocs.h"
 #include "lock_based_queue.h"
+#include "stats.h"
+#include "trace.h"
+#include "probes.h"
+#include "perf_counters.h"
 
 #ifdef CT_PTHREADS
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include "atomic.h"
 
@@ -29,15 +34,74 @@ ct_pthread_pool g_ct_pthread_pool = {
     0, 0, 0, 0
 };
 
+/* holds a worker's ID plus 1 - so it's 0 in any thread neither spawned by us
+   nor the master (the thread calling ct_init). */
+pthread_key_t g_ct_pthreads_worker_key;
+
+/* 0 for the master, 1..num_threads for the workers, -1 for other threads. */
+int ct_pthreads_worker_id(void) {
+    return (int)(size_t)pthread_getspecific(g_ct_pthreads_worker_key) - 1;
+}
+
+/* ct_work, keeping track (with $CT_STATS) of the time spent and of how
+   the indexes were divided between the workers, recording (with $CT_TRACE
+   or hooks) when they were run, and counting them ($CT_PERF_COUNTERS) */
+void ct_pthreads_work(ct_work_item* item) {
+    int prev_state = 0, done, max_done;
+    ct_perf_chunk chunk;
+    if(!g_ct_stats && !g_ct_trace && !g_ct_hooks && !g_ct_perf_counters) {
+        ct_work(item);
+        return;
+    }
+    if(g_ct_stats) {
+        prev_state = ct_stats_set_state(CT_BUSY);
+    }
+    if(g_ct_trace) {
+        ct_trace(CT_TRACE_CHUNK_BEGIN, 0);
+    }
+    if(g_ct_hooks) {
+        g_ct_hooks->chunk_begin(g_ct_hooks->user, ct_worker_id());
+    }
+    if(g_ct_perf_counters) {
+        ct_perf_chunk_begin(&chunk);
+    }
+    done = ct_work(item);
+    if(g_ct_perf_counters) {
+        ct_perf_chunk_end(&chunk);
+    }
+    if(g_ct_hooks) {
+        g_ct_hooks->chunk_end(g_ct_hooks->user, ct_worker_id(), done);
+    }
+    if(g_ct_trace) {
+        ct_trace(CT_TRACE_CHUNK_END, done);
+    }
+    if(g_ct_stats) {
+        ct_stats_set_state(prev_state);
+        while((max_done = item->max_done) < done &&
+              ATOMIC_COMPARE_AND_SWAP(&item->max_done, max_done, done) != max_done);
+    }
+}
+
+void ct_pthreads_release(ct_work_item* item) {
+    if(ATOMIC_FETCH_THEN_DECR(&item->ref_cnt, 1) == 1) {
+        if(g_ct_stats) {
+            int num_workers = g_ct_pthread_pool.num_threads + 1;
+            ct_stats_loop_imbalance(item->n, item->max_done, item->n < num_workers ? item->n : num_workers);
+        }
+        free(item);
+    }
+}
+
 void ct_pthreads_dequeue_work(ct_locked_queue* q) {
     ct_work_item* item;
     do {
         item = ct_locked_dequeue(q);
         if(item) {
-            ct_work(item);
-            if(ATOMIC_FETCH_THEN_DECR(&item->ref_cnt, 1) == 1) {
-                free(item);
+            if(g_ct_trace && item->spawner != ct_worker_id()) {
+                ct_trace(CT_TRACE_STEAL, item->spawner);
             }
+            ct_pthreads_work(item);
+            ct_pthreads_release(item);
         }
     } while(item);
 }
@@ -46,8 +110,14 @@ void* ct_pthreads_worker(void* arg) {
     int id = (int)(size_t)arg;
     ct_pthread_pool* pool = &g_ct_pthread_pool;
 
-    (void)id; /* TODO: use this to implement a ct_curr_thread() function
-                 (thread-local storage doesn't require an ID number - there are pthread keys for that. */
+    pthread_setspecific(g_ct_pthreads_worker_key, (void*)(size_t)(id+2));
+    if(g_ct_stats) {
+        ct_stats_set_state(CT_SPIN);
+    }
+    if(g_ct_hooks) {
+        g_ct_hooks->worker_start(g_ct_hooks->user, id+1);
+    }
+    ct_perf_worker_start();
 
     pthread_mutex_lock(&pool->mutex);
     ++pool->num_initialized; /* this signals the master that it should
@@ -55,8 +125,28 @@ void* ct_pthreads_worker(void* arg) {
                                 the cond var mutex */
     while(!pool->terminate) {
         /* wait unlocks the mutex while it waits... */
+        if(g_ct_stats) {
+            ct_stats_set_state(CT_IDLE);
+        }
+        if(g_ct_trace) {
+            ct_trace(CT_TRACE_PARK, 0);
+        }
+        if(g_ct_hooks) {
+            g_ct_hooks->park(g_ct_hooks->user, id+1);
+        }
+        CT_PROBE1(park, id+1);
         pthread_cond_wait(&pool->cond, &pool->mutex);
         /* ...and locks it back before it returns. */
+        CT_PROBE1(wake, id+1);
+        if(g_ct_hooks) {
+            g_ct_hooks->unpark(g_ct_hooks->user, id+1);
+        }
+        if(g_ct_trace) {
+            ct_trace(CT_TRACE_UNPARK, 0);
+        }
+        if(g_ct_stats) {
+            ct_stats_set_state(CT_SPIN);
+        }
 
         /* we're OK with spurious wakeups - ct_locked_dequeue will simply return 0 */
         pthread_mutex_unlock(&pool->mutex);
@@ -64,6 +154,9 @@ void* ct_pthreads_worker(void* arg) {
         pthread_mutex_lock(&pool->mutex);
     }
     pthread_mutex_unlock(&pool->mutex);
+    if(g_ct_hooks) {
+        g_ct_hooks->worker_stop(g_ct_hooks->user, id+1);
+    }
     return 0;
 }
 
@@ -87,6 +180,11 @@ void ct_pthreads_init(const ct_env_var* env) {
        including the master */
     num_threads--;
 
+    pthread_key_create(&g_ct_pthreads_worker_key, 0);
+    pthread_setspecific(g_ct_pthreads_worker_key, (void*)1);
+    if(g_ct_stats) {
+        ct_stats_set_state(CT_BUSY); /* the master runs the code outside loops */
+    }
     pthread_cond_init(&pool->cond, 0);
     pthread_mutex_init(&pool->mutex, 0);
     ct_locked_queue_init(&pool->q, g_ct_pthread_items, MAX_ITEMS);
@@ -117,10 +215,15 @@ void ct_pthreads_fini(void) {
     }
     pthread_mutex_destroy(&pool->mutex);
     pthread_cond_destroy(&pool->cond);
+    pthread_key_delete(g_ct_pthreads_worker_key);
     free(pool->threads);
 }
 
-void ct_pthreads_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+/* the index at the given position - the position itself unless we have a permutation */
+#define CT_PTHREADS_IND(perm, pos) ((perm) ? ct_rand_perm_at(perm, pos) : (pos))
+
+/* perm may be 0; if it isn't, the indexes are yanked in the order it specifies. */
+void ct_pthreads_for_perm(int n, ct_ind_func f, void* context, ct_canceller* c, const ct_rand_perm* perm) {
     ct_pthread_pool* pool = &g_ct_pthread_pool;
     ct_locked_queue* q = &pool->q;
     ct_work_item* item;
@@ -128,7 +231,12 @@ void ct_pthreads_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
 
     while(q->size == q->capacity) {
         --n;
-        f(n, context);
+        if(g_ct_stats) {
+            ct_stats_slot* slot = ct_stats_lock_slot();
+            slot->queue_full++;
+            ct_stats_unlock_slot(slot);
+        }
+        f(CT_PTHREADS_IND(perm, n), context);
         if(n == 0) { /* we're done while waiting... */
             return;
         }
@@ -144,11 +252,22 @@ void ct_pthreads_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
     item->context = context;
     item->ref_cnt = reps + 1;
     item->canceller = c;
+    item->shuffled = perm != 0;
+    item->max_done = 0;
+    item->spawner = ct_worker_id();
+    if(perm) {
+        item->perm = *perm; /* the item may outlive our stack frame if we're cancelled */
+    }
 
     /* try to enqueue the item, and do some work while that fails */
     while(!ct_locked_enqueue(q, item, reps)) {
         --n;
-        f(n, context);
+        if(g_ct_stats) {
+            ct_stats_slot* slot = ct_stats_lock_slot();
+            slot->queue_full++;
+            ct_stats_unlock_slot(slot);
+        }
+        f(CT_PTHREADS_IND(perm, n), context);
         if(n == 0) { /* we're done while waiting... */
             free(item);
             return;
@@ -161,20 +280,28 @@ void ct_pthreads_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
     ct_pthreads_broadcast();
 
     /* let's do our share: */
-    ct_work(item);
+    ct_pthreads_work(item);
 
     /* do work from the queue until the item is done (we may be out of indexes
        but it doesn't mean everyone else who's yanked some indexes is done;
        item->to_do reaching 0 will tell us they're done.) */
-    while(item->to_do > 0) {
-        ct_pthreads_dequeue_work(&pool->q);
+    if(item->to_do > 0) {
+        int prev_state = g_ct_stats ? ct_stats_set_state(CT_SPIN) : 0;
+        while(item->to_do > 0) {
+            ct_pthreads_dequeue_work(&pool->q);
+        }
+        if(g_ct_stats) {
+            ct_stats_set_state(prev_state);
+        }
     }
 
     item->canceller = 0; /* the canceller may be freed after we quit, so it shouldn't be accessed any more */
 
-    if(ATOMIC_FETCH_THEN_DECR(&item->ref_cnt, 1) == 1) {
-        free(item);
-    }
+    ct_pthreads_release(item);
+}
+
+void ct_pthreads_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_pthreads_for_perm(n, f, context, c, 0);
 }
 
 ct_imp g_ct_pthreads_imp = {
@@ -183,11 +310,117 @@ ct_imp g_ct_pthreads_imp = {
     &ct_pthreads_fini,
     &ct_pthreads_for,
     0, 0, 0, /* cancelling functions */
+    &ct_pthreads_worker_id,
+    0, /* loop sites */
+};
+
+/* pshuffle: the pthreads scheduler, except that every loop's indexes are yanked
+   from the queue in a random order, and workers optionally yield the CPU before
+   running an index. this perturbs the order of events similarly to shuffle,
+   but at multicore speed.
+
+   every worker has its own random state, derived from $CT_RAND_SEED and the
+   worker's ID; a loop's permutation is drawn from the state of the worker
+   spawning it. so the sequence of permutations used by the loops spawned
+   from any given worker is reproducible given the seed (though which worker
+   spawns which nested loop, and which worker runs which index, depends on timing.)
+   threads outside the pool share one more state, under a lock. */
+typedef struct {
+    ct_rand_state rand;
+    char pad[64 - sizeof(ct_rand_state)]; /* keep workers' states on separate cache lines */
+} ct_pshuffle_worker;
+
+ct_pshuffle_worker* g_ct_pshuffle_workers; /* the pool's, then the other threads' */
+int g_ct_pshuffle_others; /* the index of the other threads' state */
+pthread_mutex_t g_ct_pshuffle_others_mutex = PTHREAD_MUTEX_INITIALIZER;
+int g_ct_pshuffle_reverse;
+int g_ct_pshuffle_yield; /* percentage of indexes preceded by a sched_yield() */
+
+typedef struct {
+    ct_ind_func next_func;
+    void* next_context;
+} ct_pshuffle_func_context;
+
+void ct_pshuffle_yield_ind_func(int index, void* context) {
+    ct_pshuffle_func_context* pc = (ct_pshuffle_func_context*)context;
+    int id = ct_pthreads_worker_id();
+    uint32_t r;
+    if(id >= 0) {
+        r = ct_rand_next(&g_ct_pshuffle_workers[id].rand);
+    }
+    else {
+        pthread_mutex_lock(&g_ct_pshuffle_others_mutex);
+        r = ct_rand_next(&g_ct_pshuffle_workers[g_ct_pshuffle_others].rand);
+        pthread_mutex_unlock(&g_ct_pshuffle_others_mutex);
+    }
+    if(r % 100 < (uint32_t)g_ct_pshuffle_yield) {
+        sched_yield();
+    }
+    pc->next_func(index, pc->next_context);
+}
+
+void ct_pshuffle_init(const ct_env_var* env) {
+    uint32_t seed = (uint32_t)atoi(ct_getenv(env, "CT_RAND_SEED", "12345"));
+    ct_rand_state seeds;
+    int i, num_workers;
+
+    ct_pthreads_init(env);
+
+    g_ct_pshuffle_reverse = atoi(ct_getenv(env, "CT_RAND_REV", "0"));
+    g_ct_pshuffle_yield = atoi(ct_getenv(env, "CT_RAND_YIELD", "0"));
+
+    num_workers = g_ct_pthread_pool.num_threads + 1; /* including the master */
+    g_ct_pshuffle_others = num_workers;
+    g_ct_pshuffle_workers = (ct_pshuffle_worker*)malloc(sizeof(ct_pshuffle_worker)*(num_workers+1));
+    ct_rand_seed(&seeds, seed);
+    for(i=0; i<=num_workers; ++i) {
+        ct_rand_seed(&g_ct_pshuffle_workers[i].rand, ct_rand_next(&seeds));
+    }
+    if(g_ct_verbose) {
+        printf("checkedthreads: pshuffle seed %u, %d workers\n", (unsigned)seed, num_workers);
+    }
+}
+
+void ct_pshuffle_fini(void) {
+    ct_pthreads_fini();
+    free(g_ct_pshuffle_workers);
+}
+
+void ct_pshuffle_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
+    ct_rand_perm perm;
+    ct_pshuffle_func_context pc;
+    int id = ct_pthreads_worker_id();
+    if(id >= 0) {
+        ct_rand_perm_init(&perm, n, &g_ct_pshuffle_workers[id].rand, g_ct_pshuffle_reverse);
+    }
+    else {
+        pthread_mutex_lock(&g_ct_pshuffle_others_mutex);
+        ct_rand_perm_init(&perm, n, &g_ct_pshuffle_workers[g_ct_pshuffle_others].rand, g_ct_pshuffle_reverse);
+        pthread_mutex_unlock(&g_ct_pshuffle_others_mutex);
+    }
+    if(g_ct_pshuffle_yield > 0) {
+        pc.next_func = f;
+        pc.next_context = context;
+        f = ct_pshuffle_yield_ind_func;
+        context = &pc;
+    }
+    ct_pthreads_for_perm(n, f, context, c, &perm);
+}
+
+ct_imp g_ct_pshuffle_imp = {
+    "pshuffle",
+    &ct_pshuffle_init,
+    &ct_pshuffle_fini,
+    &ct_pshuffle_for,
+    0, 0, 0, /* cancelling functions */
+    &ct_pthreads_worker_id,
+    0, /* loop sites */
 };
 
 #else
 
 ct_imp g_ct_pthreads_imp;
+ct_imp g_ct_pshuffle_imp;
 
 #endif
 
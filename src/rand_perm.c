@@ -0,0 +1,77 @@
+#include "rand_perm.h"
+
+/* murmur3's finalizer - a cheap bijection on 32-bit values with good avalanche */
+uint32_t ct_rand_mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t ct_rand_rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+void ct_rand_seed(ct_rand_state* r, uint32_t seed) {
+    /* splitmix-style expansion: nearby seeds give unrelated states, and since
+       ct_rand_mix is a bijection, at most one of the 4 words can be 0 (an
+       all-zero state is the one state xoshiro can never leave.) */
+    int i;
+    for(i=0; i<4; ++i) {
+        seed += 0x9e3779b9U;
+        r->s[i] = ct_rand_mix(seed);
+    }
+}
+
+uint32_t ct_rand_next(ct_rand_state* r) {
+    uint32_t* s = r->s;
+    uint32_t result = ct_rand_rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = ct_rand_rotl(s[3], 11);
+    return result;
+}
+
+void ct_rand_perm_init(ct_rand_perm* p, int n, ct_rand_state* r, int reverse) {
+    int bits = 0, i;
+    while(bits < 31 && ((uint32_t)1 << bits) < (uint32_t)n) {
+        ++bits;
+    }
+    p->n = n;
+    p->reverse = reverse;
+    p->half_bits = (bits + 1) / 2; /* a balanced network needs an even number of bits */
+    for(i=0; i<CT_PERM_ROUNDS; ++i) {
+        p->keys[i] = ct_rand_next(r);
+    }
+}
+
+uint32_t ct_rand_perm_feistel(const ct_rand_perm* p, uint32_t x) {
+    int h = p->half_bits;
+    uint32_t mask = ((uint32_t)1 << h) - 1;
+    uint32_t left = x >> h;
+    uint32_t right = x & mask;
+    int i;
+    for(i=0; i<CT_PERM_ROUNDS; ++i) {
+        uint32_t tmp = left ^ (ct_rand_mix(right ^ p->keys[i]) & mask);
+        left = right;
+        right = tmp;
+    }
+    return (left << h) | right;
+}
+
+int ct_rand_perm_at(const ct_rand_perm* p, int pos) {
+    uint32_t x = (uint32_t)(p->reverse ? p->n - 1 - pos : pos);
+    /* the network permutes [0,4^half_bits), which is less than 4n; walking
+       the cycle from x until we're back in [0,n) is thus a permutation of [0,n),
+       taking at most a few steps on average. */
+    do {
+        x = ct_rand_perm_feistel(p, x);
+    } while(x >= (uint32_t)p->n);
+    return (int)x;
+}
@@ -0,0 +1,33 @@
+#ifndef CT_RAND_PERM_H_
+#define CT_RAND_PERM_H_
+
+#include <stdint.h>
+
+/* a small PRNG (xoshiro128**) keeping its state locally - so that we neither
+   depend on nor perturb the state of the user's rand(). */
+typedef struct {
+    uint32_t s[4];
+} ct_rand_state;
+
+void ct_rand_seed(ct_rand_state* r, uint32_t seed);
+uint32_t ct_rand_next(ct_rand_state* r);
+
+#define CT_PERM_ROUNDS 4
+
+/* a random permutation of [0,n), computed lazily in constant memory: a position
+   is mapped to an index by a Feistel network over the smallest power of 4 that
+   is >= n, "cycle-walking" past the results falling outside [0,n). */
+typedef struct {
+    int n;
+    int reverse;
+    int half_bits;
+    uint32_t keys[CT_PERM_ROUNDS];
+} ct_rand_perm;
+
+/* draws the permutation's keys from r. reverse!=0 yields the same
+   sequence of indexes that reverse==0 would have yielded, backwards. */
+void ct_rand_perm_init(ct_rand_perm* p, int n, ct_rand_state* r, int reverse);
+/* returns the index at the given position, 0 <= pos < n. */
+int ct_rand_perm_at(const ct_rand_perm* p, int pos);
+
+#endif
@@ -23,4 +23,6 @@ ct_imp g_ct_serial_imp = {
     &ct_serial_fini,
     &ct_serial_for,
     0, 0, 0, /* cancelling functions */
+    0, /* a single worker */
+    0, /* loop sites */
 };
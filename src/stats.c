@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "clock.h"
+
+int g_ct_stats;
+ct_stats_slot* g_ct_stats_slots;
+int g_ct_stats_scheduler; /* 1 if the scheduler keeps the queue, imbalance and time statistics */
+
+void ct_stats_init(const ct_env_var* env) {
+    const char* stats = ct_getenv(env, "CT_STATS", "0");
+    int i;
+    if(strcmp(stats, "json") == 0) {
+        g_ct_stats = CT_STATS_JSON;
+    }
+    else {
+        g_ct_stats = strcmp(stats, "0") != 0 && *stats ? CT_STATS_TEXT : 0;
+    }
+    if(!g_ct_stats) {
+        return;
+    }
+    g_ct_stats_slots = (ct_stats_slot*)calloc(g_ct_num_workers+1, sizeof(ct_stats_slot));
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        g_ct_stats_slots[i].state = -1;
+    }
+    g_ct_stats_slots[g_ct_num_workers].shared = 1;
+}
+
+ct_stats_slot* ct_stats_lock_slot(void) {
+    int worker = ct_worker_id();
+    ct_lock_worker(worker);
+    return &g_ct_stats_slots[worker];
+}
+
+void ct_stats_unlock_slot(ct_stats_slot* slot) {
+    ct_unlock_worker((int)(slot - g_ct_stats_slots));
+}
+
+/* named sites are keyed by the name, unnamed ones by the caller */
+ct_stats_site* ct_stats_site_of(ct_stats_slot* slot, const char* name, const void* caller) {
+    size_t key = (size_t)(name ? (const void*)name : caller);
+    int i, h = (int)((key >> 4) % CT_STATS_SITES);
+    for(i=0; i<CT_STATS_SITES; ++i) {
+        ct_stats_site* site = &slot->sites[(h + i) % CT_STATS_SITES];
+        if(!site->name && !site->caller) {
+            site->name = name;
+            site->caller = caller;
+            return site;
+        }
+        if(site->name == name && (name || site->caller == caller)) {
+            return site;
+        }
+    }
+    return 0;
+}
+
+int ct_stats_set_state(int state) {
+    ct_stats_slot* slot = &g_ct_stats_slots[ct_worker_id()];
+    int prev = slot->state;
+    double now = ct_curr_sec();
+    g_ct_stats_scheduler = 1;
+    if(slot->shared) {
+        return -1;
+    }
+    if(prev >= 0) {
+        slot->time[prev] += now - slot->since;
+    }
+    slot->state = state;
+    slot->since = now;
+    return prev;
+}
+
+void ct_stats_loop_imbalance(int n, int max_indexes_per_worker, int workers) {
+    ct_stats_slot* slot;
+    double imbalance;
+    if(n <= 0 || workers <= 0) {
+        return;
+    }
+    imbalance = (double)max_indexes_per_worker * workers / n;
+    slot = ct_stats_lock_slot();
+    slot->balanced_loops++;
+    slot->imbalance_sum += imbalance;
+    if(imbalance > slot->imbalance_max) {
+        slot->imbalance_max = imbalance;
+    }
+    ct_stats_unlock_slot(slot);
+}
+
+int ct_get_stats(ct_stats* stats, ct_worker_stats* workers, int max_workers) {
+    double now = ct_curr_sec();
+    double imbalance_sum = 0;
+    int i;
+    memset(stats, 0, sizeof(ct_stats));
+    if(!g_ct_stats) {
+        return 0;
+    }
+    stats->num_workers = g_ct_num_workers;
+    for(i=0; i<=g_ct_num_workers; ++i) { /* including the shared slot */
+        const ct_stats_slot* slot = &g_ct_stats_slots[i];
+        stats->loops += slot->loops;
+        stats->indexes += slot->indexes;
+        stats->queue_full += slot->queue_full;
+        stats->lock_acquisitions += slot->lock_acquisitions;
+        stats->lock_contentions += slot->lock_contentions;
+        stats->balanced_loops += slot->balanced_loops;
+        imbalance_sum += slot->imbalance_sum;
+        if(slot->imbalance_max > stats->max_imbalance) {
+            stats->max_imbalance = slot->imbalance_max;
+        }
+        if(slot->max_depth > stats->max_depth) {
+            stats->max_depth = slot->max_depth;
+        }
+        if(workers && i < max_workers && !slot->shared) {
+            double time[3];
+            memcpy(time, slot->time, sizeof time);
+            if(slot->state >= 0) { /* the time in the current state counts up to now */
+                time[slot->state] += now - slot->since;
+            }
+            workers[i].busy = time[CT_BUSY];
+            workers[i].spin = time[CT_SPIN];
+            workers[i].idle = time[CT_IDLE];
+        }
+    }
+    if(stats->balanced_loops) {
+        stats->mean_imbalance = imbalance_sum / stats->balanced_loops;
+    }
+    return 1;
+}
+
+int ct_stats_same_site(const ct_stats_site* a, const ct_stats_site* b) {
+    if(a->name || b->name) {
+        return a->name && b->name && strcmp(a->name, b->name) == 0;
+    }
+    return a->caller == b->caller;
+}
+
+int ct_stats_cmp_sites(const void* a, const void* b) {
+    double ta = ((const ct_stats_site*)a)->time, tb = ((const ct_stats_site*)b)->time;
+    return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+/* merges the workers' sites into sites, slowest first; returns their number */
+int ct_stats_merge_sites(ct_stats_site* sites) {
+    int num_sites = 0, i, j, k;
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        for(j=0; j<CT_STATS_SITES; ++j) {
+            const ct_stats_site* site = &g_ct_stats_slots[i].sites[j];
+            if(!site->loops) {
+                continue;
+            }
+            for(k=0; k<num_sites && !ct_stats_same_site(&sites[k], site); ++k);
+            if(k == num_sites) {
+                sites[num_sites++] = *site;
+            }
+            else {
+                sites[k].loops += site->loops;
+                sites[k].indexes += site->indexes;
+                sites[k].time += site->time;
+            }
+        }
+    }
+    qsort(sites, num_sites, sizeof(ct_stats_site), ct_stats_cmp_sites);
+    return num_sites;
+}
+
+void ct_stats_print(const ct_stats* s, const ct_worker_stats* workers) {
+    ct_stats_site* sites = (ct_stats_site*)malloc(sizeof(ct_stats_site)*CT_STATS_SITES*(g_ct_num_workers+1));
+    int num_sites = ct_stats_merge_sites(sites);
+    char buf[CT_SITE_NAME_SIZE];
+    int i;
+    if(g_ct_stats == CT_STATS_JSON) {
+        printf("{\"loops\": %lu, \"indexes\": %lu, \"max_depth\": %d, \"queue_full\": %lu, "
+               "\"lock_acquisitions\": %lu, \"lock_contentions\": %lu, \"balanced_loops\": %lu, "
+               "\"mean_imbalance\": %.3f, \"max_imbalance\": %.3f, \"workers\": [",
+               s->loops, s->indexes, s->max_depth, s->queue_full, s->lock_acquisitions,
+               s->lock_contentions, s->balanced_loops, s->mean_imbalance, s->max_imbalance);
+        for(i=0; i<s->num_workers; ++i) {
+            printf("%s{\"busy\": %.6f, \"spin\": %.6f, \"idle\": %.6f}", i ? ", " : "",
+                   workers[i].busy, workers[i].spin, workers[i].idle);
+        }
+        printf("], \"sites\": [");
+        for(i=0; i<num_sites; ++i) {
+            printf("%s{\"name\": ", i ? ", " : "");
+            ct_print_json_string(stdout, ct_site_name(sites[i].name, sites[i].caller, buf));
+            printf(", \"loops\": %lu, \"indexes\": %lu, \"time\": %.6f}",
+                   sites[i].loops, sites[i].indexes, sites[i].time);
+        }
+        printf("]}\n");
+        free(sites);
+        return;
+    }
+    printf("checkedthreads: stats: %lu loops, %lu indexes, max depth %d\n",
+           s->loops, s->indexes, s->max_depth);
+    for(i=0; i<num_sites; ++i) {
+        printf("checkedthreads: stats: loop %s: %lu runs, %lu indexes, %.6f s\n",
+               ct_site_name(sites[i].name, sites[i].caller, buf),
+               sites[i].loops, sites[i].indexes, sites[i].time);
+    }
+    free(sites);
+    if(!g_ct_stats_scheduler) {
+        return; /* the scheduler doesn't keep the rest */
+    }
+    printf("checkedthreads: stats: %lu indexes run by the spawner with the queue full; "
+           "queue lock acquired %lu times, %lu of them contended\n",
+           s->queue_full, s->lock_acquisitions, s->lock_contentions);
+    printf("checkedthreads: stats: index imbalance (most indexes run by a worker / even share) "
+           "over %lu loops: mean %.3f, max %.3f\n",
+           s->balanced_loops, s->mean_imbalance, s->max_imbalance);
+    for(i=0; i<s->num_workers; ++i) {
+        printf("checkedthreads: stats: worker %d: busy %.6f s, spin %.6f s, idle %.6f s\n",
+               i, workers[i].busy, workers[i].spin, workers[i].idle);
+    }
+}
+
+void ct_stats_fini(void) {
+    ct_stats stats;
+    ct_worker_stats* workers;
+    if(!g_ct_stats) {
+        return;
+    }
+    workers = (ct_worker_stats*)malloc(sizeof(ct_worker_stats)*g_ct_num_workers);
+    ct_get_stats(&stats, workers, g_ct_num_workers);
+    ct_stats_print(&stats, workers);
+    free(workers);
+    free(g_ct_stats_slots);
+    g_ct_stats_slots = 0;
+    g_ct_stats = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef CT_STATS_H_
+#define CT_STATS_H_
+
+#include "imp.h"
+
+/* the loops run from a call site (see ct_site_name), counted by the
+   worker which called ct_for; indexes are counted as requested */
+typedef struct {
+    const char* name;
+    const void* caller;
+    unsigned long loops;
+    unsigned long indexes;
+    double time; /* from entering ct_for to returning, nested loops included */
+} ct_stats_site;
+
+/* the sites a worker keeps - loops from any further sites are still
+   counted, but not per site */
+#define CT_STATS_SITES 64
+
+/* $CT_STATS: every worker counts events in a slot of its own, so counting
+   takes no atomic operations; ct_get_stats sums the slots. threads without
+   a worker ID share one more slot under a lock (see ct_lock_worker). */
+typedef struct {
+    unsigned long loops;
+    unsigned long indexes;
+    unsigned long queue_full;
+    unsigned long lock_acquisitions;
+    unsigned long lock_contentions;
+    unsigned long balanced_loops;
+    double imbalance_sum;
+    double imbalance_max;
+    int shared; /* 1 for the slot of threads without a worker ID, which leaves depth at 0 */
+    int depth; /* of the loop running on this worker (0 outside loops) */
+    int max_depth;
+    int state; /* CT_BUSY, CT_SPIN, CT_IDLE, or -1 if the time isn't tracked */
+    double since; /* the time of entering the state */
+    double time[3];
+    ct_stats_site sites[CT_STATS_SITES]; /* a hash table */
+    char pad[64]; /* keep the slots' counters on separate cache lines */
+} ct_stats_slot;
+
+#define CT_BUSY 0
+#define CT_SPIN 1
+#define CT_IDLE 2
+
+#define CT_STATS_TEXT 1
+#define CT_STATS_JSON 2
+
+extern int g_ct_stats; /* 0, CT_STATS_TEXT or CT_STATS_JSON */
+
+void ct_stats_init(const ct_env_var* env);
+void ct_stats_fini(void);
+/* the calling worker's slot, to be updated until ct_stats_unlock_slot */
+ct_stats_slot* ct_stats_lock_slot(void);
+void ct_stats_unlock_slot(ct_stats_slot* slot);
+/* the slot's entry for the site, or 0 if the slot's table is full */
+ct_stats_site* ct_stats_site_of(ct_stats_slot* slot, const char* name, const void* caller);
+/* returns the worker's previous state, to be restored later (the time of
+   threads without a worker ID isn't tracked) */
+int ct_stats_set_state(int state);
+/* the imbalance of a loop is the most indexes run by a worker relative to
+   an even division of the n indexes between the given number of workers */
+void ct_stats_loop_imbalance(int n, int max_indexes_per_worker, int workers);
+
+#endif
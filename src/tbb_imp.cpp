@@ -1,11 +1,34 @@
 #include "imp.h"
+#include "perf_counters.h"
 
 #ifdef CT_TBB
 
 #include <tbb/tbb.h>
 
+/* the thread's index in its arena - 0 for the master, -1 outside the arena */
+int ctx_tbb_worker_id(void) {
+    return tbb::this_task_arena::current_thread_index();
+}
+
+/* reports TBB's threads entering and leaving the scheduler to the hooks */
+struct ctx_tbb_observer : public tbb::task_scheduler_observer {
+    void on_scheduler_entry(bool is_worker) {
+        if(is_worker && g_ct_hooks) {
+            g_ct_hooks->worker_start(g_ct_hooks->user, ct_worker_id());
+        }
+    }
+    void on_scheduler_exit(bool is_worker) {
+        if(is_worker && g_ct_hooks) {
+            g_ct_hooks->worker_stop(g_ct_hooks->user, ct_worker_id());
+        }
+    }
+};
+
+ctx_tbb_observer g_ctx_tbb_observer;
+
 void ctx_tbb_init(const ct_env_var* env) {
     int num_threads = atoi(ct_getenv(env, "CT_THREADS", "0"));
+    g_ctx_tbb_observer.observe(true);
     if(num_threads) {
         static tbb::task_scheduler_init init(num_threads);
     }
@@ -15,6 +38,7 @@ void ctx_tbb_init(const ct_env_var* env) {
 }
 
 void ctx_tbb_fini(void) {
+    g_ctx_tbb_observer.observe(false);
 }
 
 struct ctx_invoker {
@@ -25,15 +49,29 @@ struct ctx_invoker {
     void operator()(const tbb::blocked_range<int>& range) const {
         int begin = range.begin();
         int end = range.end();
+        ct_perf_chunk chunk;
+        if(g_ct_hooks) {
+            g_ct_hooks->chunk_begin(g_ct_hooks->user, ct_worker_id());
+        }
+        if(g_ct_perf_counters) {
+            ct_perf_chunk_begin(&chunk);
+        }
         for(int i=begin; i<end; ++i) {
             if(canceller->cancelled) {
                 tbb::task::self().cancel_group_execution();
-                return;
+                end = i;
+                break;
             }
             else {
                 f(i, context);
             }
         }
+        if(g_ct_perf_counters) {
+            ct_perf_chunk_end(&chunk);
+        }
+        if(g_ct_hooks) {
+            g_ct_hooks->chunk_end(g_ct_hooks->user, ct_worker_id(), end - begin);
+        }
     }
 };
 
@@ -66,6 +104,8 @@ ct_imp g_ct_tbb_imp = {
     &ctx_tbb_fini,
     &ctx_tbb_for,
     0, 0, 0, /* cancelling functions */
+    &ctx_tbb_worker_id,
+    0, /* loop sites */
 };
 
 #else
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "trace.h"
+#include "clock.h"
+
+typedef struct {
+    uint64_t tsc;
+    int type;
+    int arg;
+    const char* name; /* CT_TRACE_LOOP_BEGIN: the loop's site */
+    const void* caller;
+} ct_trace_event;
+
+/* the most recent events are kept when the buffer wraps around */
+#define CT_TRACE_EVENTS (64*1024) /* per worker; a power of 2 */
+
+typedef struct {
+    ct_trace_event* events;
+    unsigned long count;
+    char pad[64]; /* keep the workers' counts on separate cache lines */
+} ct_trace_buffer;
+
+int g_ct_trace;
+const char* g_ct_trace_path;
+ct_trace_buffer* g_ct_trace_buffers;
+uint64_t g_ct_trace_start_tsc;
+double g_ct_trace_start_sec;
+
+uint64_t ct_trace_tsc(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return (uint64_t)(ct_curr_sec() * 1e9);
+#endif
+}
+
+void ct_trace_init(const ct_env_var* env) {
+    int i;
+    g_ct_trace_path = ct_getenv(env, "CT_TRACE", "");
+    g_ct_trace = *g_ct_trace_path != 0;
+    if(!g_ct_trace) {
+        return;
+    }
+    g_ct_trace_buffers = (ct_trace_buffer*)calloc(g_ct_num_workers+1, sizeof(ct_trace_buffer));
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        g_ct_trace_buffers[i].events = (ct_trace_event*)malloc(sizeof(ct_trace_event)*CT_TRACE_EVENTS);
+    }
+    g_ct_trace_start_sec = ct_curr_sec();
+    g_ct_trace_start_tsc = ct_trace_tsc();
+}
+
+void ct_trace_record(int type, int arg, const char* name, const void* caller) {
+    int worker = ct_worker_id();
+    ct_trace_buffer* b = &g_ct_trace_buffers[worker];
+    ct_trace_event* e;
+    ct_lock_worker(worker);
+    e = &b->events[b->count++ & (CT_TRACE_EVENTS-1)];
+    e->tsc = ct_trace_tsc();
+    e->type = type;
+    e->arg = arg;
+    e->name = name;
+    e->caller = caller;
+    ct_unlock_worker(worker);
+}
+
+void ct_trace(int type, int arg) {
+    ct_trace_record(type, arg, 0, 0);
+}
+
+void ct_trace_loop_begin(int n, const char* name, const void* caller) {
+    ct_trace_record(CT_TRACE_LOOP_BEGIN, n, name, caller);
+}
+
+/* Chrome trace events: B/E begin and end a duration, i is an instant.
+   loops are named by their site, and all events by their category */
+const char* g_ct_trace_names[] = {"ct_for", "ct_for", "indexes", "indexes", "steal", "parked", "parked"};
+const char* g_ct_trace_phases[] = {"B", "E", "B", "E", "i", "B", "E"};
+
+void ct_trace_write_event(FILE* f, const ct_trace_event* e, int worker, double usec_per_tick) {
+    char buf[CT_SITE_NAME_SIZE];
+    fprintf(f, ",\n{\"name\": ");
+    if(e->type == CT_TRACE_LOOP_BEGIN) {
+        ct_print_json_string(f, ct_site_name(e->name, e->caller, buf));
+    }
+    else {
+        fprintf(f, "\"%s\"", g_ct_trace_names[e->type]);
+    }
+    fprintf(f, ", \"cat\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d",
+            g_ct_trace_names[e->type], g_ct_trace_phases[e->type],
+            (double)(int64_t)(e->tsc - g_ct_trace_start_tsc) * usec_per_tick, worker);
+    switch(e->type) {
+        case CT_TRACE_LOOP_BEGIN: fprintf(f, ", \"args\": {\"n\": %d}", e->arg); break;
+        case CT_TRACE_CHUNK_END: fprintf(f, ", \"args\": {\"indexes run\": %d}", e->arg); break;
+        case CT_TRACE_STEAL: fprintf(f, ", \"s\": \"t\", \"args\": {\"spawner\": %d}", e->arg); break;
+        default: break;
+    }
+    fprintf(f, "}");
+}
+
+/* a wrapped buffer may have lost the B events of its first E events -
+   these are dropped (the durations are nested, so an E is unmatched
+   exactly when no B is open before it) */
+void ct_trace_write_buffer(FILE* f, const ct_trace_buffer* b, int worker, double usec_per_tick) {
+    unsigned long first = b->count > CT_TRACE_EVENTS ? b->count - CT_TRACE_EVENTS : 0;
+    unsigned long j;
+    int open = 0;
+    for(j=first; j<b->count; ++j) {
+        const ct_trace_event* e = &b->events[j & (CT_TRACE_EVENTS-1)];
+        if(*g_ct_trace_phases[e->type] == 'B') {
+            open++;
+        }
+        else if(*g_ct_trace_phases[e->type] == 'E') {
+            if(open == 0) {
+                continue;
+            }
+            open--;
+        }
+        ct_trace_write_event(f, e, worker, usec_per_tick);
+    }
+}
+
+void ct_trace_fini(void) {
+    double usec_per_tick;
+    FILE* f;
+    int i;
+    if(!g_ct_trace) {
+        return;
+    }
+    /* the timestamp counter's rate, measured over the run */
+    usec_per_tick = (ct_curr_sec() - g_ct_trace_start_sec) * 1e6 /
+                    (double)(ct_trace_tsc() - g_ct_trace_start_tsc);
+    f = fopen(g_ct_trace_path, "w");
+    if(!f) {
+        printf("checkedthreads - WARNING: can't write the trace to %s\n", g_ct_trace_path);
+    }
+    else {
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+                   "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"checkedthreads\"}}");
+        for(i=0; i<=g_ct_num_workers; ++i) {
+            const ct_trace_buffer* b = &g_ct_trace_buffers[i];
+            if(i == g_ct_num_workers) {
+                if(!b->count) {
+                    continue;
+                }
+                fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"name\": \"other threads\"}}", i);
+            }
+            else {
+                fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"name\": \"worker %d\"}}", i, i);
+            }
+            ct_trace_write_buffer(f, b, i, usec_per_tick);
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+    }
+    for(i=0; i<=g_ct_num_workers; ++i) {
+        free(g_ct_trace_buffers[i].events);
+    }
+    free(g_ct_trace_buffers);
+    g_ct_trace = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CT_TRACE_H_
+#define CT_TRACE_H_
+
+#include "imp.h"
+
+/* $CT_TRACE: every worker records events into a ring buffer of its own
+   (so recording takes no locks or atomic operations), and the buffers
+   are written out as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+   at ct_fini. threads without a worker ID share one more buffer under a
+   lock (see ct_lock_worker), written as a single "other threads" track. */
+#define CT_TRACE_LOOP_BEGIN 0 /* arg: the number of indexes */
+#define CT_TRACE_LOOP_END 1
+#define CT_TRACE_CHUNK_BEGIN 2 /* a worker starts running a loop's indexes */
+#define CT_TRACE_CHUNK_END 3 /* arg: the number of indexes run */
+#define CT_TRACE_STEAL 4 /* arg: the worker which spawned the dequeued loop */
+#define CT_TRACE_PARK 5 /* a worker sleeps until there's work */
+#define CT_TRACE_UNPARK 6
+
+extern int g_ct_trace; /* 1 if $CT_TRACE is set */
+
+void ct_trace_init(const ct_env_var* env);
+void ct_trace_fini(void);
+void ct_trace(int type, int arg);
+void ct_trace_loop_begin(int n, const char* name, const void* caller);
+
+#endif
@@ -2,70 +2,77 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "imp.h"
-
-#define STORED_MAGIC 0x12345678
-#define CONST_MAGIC "Valgrind command"
-#define MAX_CMD 128
-
-struct {
-    volatile int32_t stored_magic;
-    const char const_magic[16];
-    volatile char payload[MAX_CMD];
-} g_ct_valgrind_cmd = { 0, CONST_MAGIC, "" };
-
-void ct_valgrind_ptr(int oft, volatile const void* ptr) {
-    *(volatile const void**)&g_ct_valgrind_cmd.payload[oft] = ptr;
-}
-
-void ct_valgrind_int(int oft, int num) {
-    *(volatile int32_t*)&g_ct_valgrind_cmd.payload[oft] = num;
-}
-
-void ct_valgrind_cmd(const char* str) {
-    int i;
-    for(i=0; str[i]; ++i) {
-        g_ct_valgrind_cmd.payload[i] = str[i];
-    }
-    g_ct_valgrind_cmd.stored_magic = STORED_MAGIC;
+#include "rand_perm.h"
+
+/* client requests to the checkedthreads Valgrind tool; the codes must match
+   the ones in valgrind/checkedthreads_main.c. */
+#define CT_USERREQ_BASE (((uintptr_t)'C' << 24) | ((uintptr_t)'T' << 16))
+#define CT_USERREQ_BEGIN_FOR (CT_USERREQ_BASE+0) /* push state, set stack bottom, deactivate */
+#define CT_USERREQ_END_FOR (CT_USERREQ_BASE+1) /* pop state (possibly re-activating checking) */
+#define CT_USERREQ_ITER (CT_USERREQ_BASE+2) /* set thread ID & index, activate checking */
+#define CT_USERREQ_DONE (CT_USERREQ_BASE+3) /* deactivate checking */
+#define CT_USERREQ_GET_OWNER (CT_USERREQ_BASE+4)
+#define CT_USERREQ_SET_SEED (CT_USERREQ_BASE+5) /* for reproducible --check-sample */
+
+/* the "special instruction sequence" of valgrind.h's VALGRIND_DO_CLIENT_REQUEST:
+   a no-op natively, a call to the tool's request handler under Valgrind.
+   we spell it out to not depend on Valgrind's headers being installed. */
+uintptr_t ct_valgrind_request(uintptr_t def, uintptr_t req, uintptr_t arg1, uintptr_t arg2) {
+    volatile uintptr_t args[6];
+    volatile uintptr_t result = def;
+    args[0] = req;
+    args[1] = arg1;
+    args[2] = arg2;
+    args[3] = args[4] = args[5] = 0;
+#if defined(__GNUC__) && defined(__x86_64__)
+    __asm__ __volatile__("rolq $3,  %%rdi ; rolq $13, %%rdi\n\t"
+                         "rolq $61, %%rdi ; rolq $51, %%rdi\n\t"
+                         "xchgq %%rbx,%%rbx"
+                         : "=d" (result)
+                         : "a" (&args[0]), "0" (def)
+                         : "cc", "memory");
+#elif defined(__GNUC__) && defined(__i386__)
+    __asm__ __volatile__("roll $3,  %%edi ; roll $13, %%edi\n\t"
+                         "roll $29, %%edi ; roll $19, %%edi\n\t"
+                         "xchgl %%ebx,%%ebx"
+                         : "=d" (result)
+                         : "a" (&args[0]), "0" (def)
+                         : "cc", "memory");
+#endif
+    return result;
 }
 
 void ct_shuffle_init(const ct_env_var* env);
+extern uint32_t g_ct_rand_seed;
 void ct_valgrind_init(const ct_env_var* env) {
     ct_shuffle_init(env); /* pass $CT_RAND_SEED and $CT_RAND_REV */
+    ct_valgrind_request(0, CT_USERREQ_SET_SEED, g_ct_rand_seed, 0);
 }
 
 void ct_valgrind_fini(void) {
 }
 
-int* ct_rand_perm(int n);
+void ct_shuffle_perm_init(ct_rand_perm* perm, int n);
 
+/* checking is deactivated by begin_for, so random permutation generation
+   is not "checked"; each iteration costs exactly two requests. */
 void ct_valgrind_for_loop(int n, ct_ind_func f, void* context, ct_canceller* c) {
     int i;
-    int* perm;
-    /* deactivate so that random permutation generation is not "checked" */
-    ct_valgrind_int(8, 0);
-    ct_valgrind_cmd("setactiv");
-
-    perm = ct_rand_perm(n);
+    ct_rand_perm perm;
+    ct_shuffle_perm_init(&perm, n);
 
     for(i=0; i<n; ++i) {
-        int ind = perm[i];
+        int ind = ct_rand_perm_at(&perm, i); /* computed while checking is deactivated */
         /* thread ID != index because of thread-local storage, if we ever add that...
-           [and because of the ID range being smaller... but that's another matter.] */
-        ct_valgrind_int(4, ind%254); /* there are 254 IDs (0 and 255 are reserved;
-                                      1 is added by Valgrind and subtracted back in messages). */
-        ct_valgrind_cmd("thrd");
-
-        ct_valgrind_int(4, ind);
-        ct_valgrind_cmd("iter"); /* activate checking */
+           [and because of the ID range being smaller... but that's another matter.]
+           there are 253 IDs (0, 254 and 255 are reserved; 1 is added by Valgrind and
+           subtracted back in messages). */
+        ct_valgrind_request(0, CT_USERREQ_ITER, ind%253, ind);
 
         f(ind, context);
 
-        ct_valgrind_int(4, ind); /* deactivate checking */
-        ct_valgrind_cmd("done");
+        ct_valgrind_request(0, CT_USERREQ_DONE, ind, 0);
     }
-
-    free(perm);
 }
 
 /* "volatile" for portable inlining prevention (instead of __attribute__((noinline))) */
@@ -74,24 +81,18 @@ volatile ct_imp_for_func g_ct_valgrind_for = &ct_valgrind_for_loop;
 /* under Valgrind, loops run to completion even if canceled */
 void ct_valgrind_for(int n, ct_ind_func f, void* context, ct_canceller* c) {
     volatile int local=0;
-    ct_valgrind_cmd("begin_for"); /* push state (including whether checking is activated) */
-
-    ct_valgrind_ptr(8, &local);
-    ct_valgrind_cmd("stackbot");
+    /* push state (including whether checking is activated), with the stack
+       below local as the stack of the loop */
+    ct_valgrind_request(0, CT_USERREQ_BEGIN_FOR, (uintptr_t)&local, 0);
 
     (*g_ct_valgrind_for)(n,f,context,c);
 
-    ct_valgrind_cmd("end_for"); /* pop state (possibly re-activating checking) */
+    ct_valgrind_request(0, CT_USERREQ_END_FOR, 0, 0);
 }
 
 int ct_debug_get_owner(const void* addr) {
-    volatile int i,m;
-    ct_valgrind_ptr(8, addr);
-    ct_valgrind_cmd("getowner");
-    for(i=0; i<5; ++i) {
-        m = g_ct_valgrind_cmd.stored_magic;
-    }
-    return g_ct_valgrind_cmd.stored_magic == STORED_MAGIC ? CT_OWNER_UNKNOWN : g_ct_valgrind_cmd.stored_magic;
+    return (int)(intptr_t)ct_valgrind_request((uintptr_t)(intptr_t)CT_OWNER_UNKNOWN,
+                                              CT_USERREQ_GET_OWNER, (uintptr_t)addr, 0);
 }
 
 ct_imp g_ct_valgrind_imp = {
@@ -100,4 +101,6 @@ ct_imp g_ct_valgrind_imp = {
     &ct_valgrind_fini,
     &ct_valgrind_for,
     0, 0, 0, /* cancelling functions (TODO: some should be non-0) */
+    0, /* a single worker */
+    0, /* loop sites */
 };
@@ -1,7 +1,8 @@
 #include "work_item.h"
 #include "atomic.h"
 
-void ct_work(ct_work_item* item) {
+int ct_work(ct_work_item* item) {
+    int done = 0;
     int n = item->n;
     ct_ind_func f = item->f;
     void* context = item->context;
@@ -15,8 +16,10 @@ void ct_work(ct_work_item* item) {
                 item->next_ind = n; /* OK similarly to to_do above. */
                 break;
             }
-            f(next_ind, context);
+            f(item->shuffled ? ct_rand_perm_at(&item->perm, next_ind) : next_ind, context);
+            ++done;
             ATOMIC_FETCH_THEN_DECR(&item->to_do, 1);
         }
     }
+    return done;
 }
@@ -2,6 +2,7 @@
 #define CT_WORK_ITEM_H_
 
 #include "imp.h"
+#include "rand_perm.h"
 
 typedef struct {
     volatile int next_ind;
@@ -11,11 +12,16 @@ typedef struct {
     ct_ind_func f;
     void* context;
     ct_canceller* volatile canceller;
+    int shuffled; /* if non-0, the i-th yanked index is perm's i-th index rather than i */
+    ct_rand_perm perm;
+    volatile int max_done; /* $CT_STATS: the most indexes run by a ct_work call */
+    int spawner; /* $CT_TRACE: the ID of the worker which called ct_for */
 } ct_work_item;
 
 /* returns when next_ind reaches or exceeds n - all work was already yanked.
-   this doesn't mean we're done - to_do==0 means that. */
-void ct_work(ct_work_item* item);
+   this doesn't mean we're done - to_do==0 means that. returns the number
+   of indexes run by this call. */
+int ct_work(ct_work_item* item);
 
 #endif
 
@@ -11,7 +11,7 @@ import sys
 import build
 import commands
 
-tests = 'bug.cpp sleep.cpp nested.cpp grain.cpp acc.cpp cancel.cpp sort.cpp'.split()
+tests = 'bug.cpp war.cpp sleep.cpp nested.cpp nested_local.cpp named.cpp grain.cpp acc.cpp cancel.cpp sort.cpp perm.cpp'.split()
 
 with_cpp = 'C++11' in build.enabled
 with_pthreads = 'pthreads' in build.enabled
@@ -26,6 +26,7 @@ def buildtest(*args):
     built.append(build.buildtest(*args))
 
 buildtest('hello_ct.c')
+buildtest('hooks.c')
 if with_pthreads: buildtest('hello_ct.c','_pthreads')
 if with_openmp: buildtest('hello_ct.c','_openmp')
 
@@ -40,11 +41,13 @@ for test in tests:
         continue
     buildtest(test)
 
-scheds = 'serial shuffle valgrind openmp tbb pthreads'.split()
+scheds = 'serial shuffle valgrind openmp tbb pthreads pshuffle'.split()
 # remove schedulers which we aren't configured to support
 def lower(ls): return [s.lower() for s in ls]
 scheds = [sched for sched in scheds if not (sched in lower(build.features) \
                                         and sched not in lower(build.enabled))]
+if not with_pthreads:
+    scheds.remove('pshuffle') # built on top of the pthreads scheduler
 
 failed = []
 def fail(command):
@@ -70,13 +73,13 @@ def runcommand(command,expected_status=0,expected_output=None):
 
 print '\nrunning tests'
 
-testscripts = 'hello.py bug.py nested.py sleep.py'.split()
+testscripts = 'hello.py bug.py nested.py sleep.py perm.py profile.py stats.py trace.py hooks.py perf_counters.py'.split()
 
 for testscript in testscripts:
     execfile('test/'+testscript)
 
 for test in built:
-    if test in 'bug nested sleep'.split() or test.startswith('hello'):
+    if test in 'bug nested sleep perm'.split() or test.startswith('hello'):
         continue
     if test == 'sort':
         runtest(test,args=str(1024*1024))
@@ -1,6 +1,7 @@
 #include "checkedthreads.h"
 #include "time.h"
 #include <stdio.h>
+#include <stdlib.h>
 #ifdef CT_TBB
 #include <tbb/tbb.h>
 #endif
@@ -29,7 +30,11 @@ T ctx_accumulate(Iter first, Iter last, T init, BinOp f,
 
 #define N (1024*1024*7)
 
-int main() {
+int main(int argc, char** argv) {
+    int serial_cutoff = 1024*32;
+    if(argc>1) {
+        serial_cutoff = atoi(argv[1]);
+    }
     ct_init(0);
     int* arr = new int[N];
     for(int i=0; i<N; ++i) {
@@ -39,7 +44,7 @@ int main() {
     usec_t s1 = curr_usec();
     int sum1 = std::accumulate(arr, arr+N, 20, plus);
     usec_t s2 = curr_usec();
-    int sum2 = ctx_accumulate(arr, arr+N, 20, plus, 1024*32);
+    int sum2 = ctx_accumulate(arr, arr+N, 20, plus, serial_cutoff);
     usec_t s3 = curr_usec();
 #ifdef CT_TBB
     int sum3 = tbb::parallel_reduce(tbb::blocked_range<int>(0, N, 1024*32), 0,
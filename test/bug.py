@@ -19,3 +19,17 @@ if not ((loc1 in o1 and loc2 in o2) or \
     fail(c2)
 elif verbose:
     print ' ','bug found when running either of the random orders'
+
+# war: with readers tracked, a single run finds the race in either order;
+# without them, only the order running the write first finds it
+def war(rev, options=''):
+    s, o, c = runcommand('env CT_SCHED=valgrind CT_RAND_REV=%d valgrind --tool=checkedthreads %s ./bin/war'%(rev,options),expected_status=None)
+    return 'checkedthreads: error' in o and 'results:' in o, c
+found = [war(rev) for rev in [0,1]]
+for f, c in found:
+    if not f:
+        fail(c)
+untracked = [war(rev,'--track-readers=no') for rev in [0,1]]
+if [f for f, c in untracked].count(True) != 1:
+    fail(untracked[0][1])
+    fail(untracked[1][1])
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include "checkedthreads.h"
+
+/* counts the events reported to the hooks, which may be called concurrently */
+#define LOOP_BEGIN 0
+#define LOOP_END 1
+#define WORKER_START 2
+#define WORKER_STOP 3
+#define CHUNK_BEGIN 4
+#define CHUNK_END 5
+#define INDEXES_RUN 6
+#define PARK 7
+#define UNPARK 8
+#define NUM_COUNTS 9
+volatile int counts[NUM_COUNTS];
+
+void count(void* user, int what, int n) {
+    (void)user;
+    __sync_fetch_and_add(&counts[what], n);
+}
+
+void loop_begin(void* user, int worker, const char* name, const void* caller, int n) {
+    (void)worker; (void)name; (void)caller; (void)n;
+    count(user, LOOP_BEGIN, 1);
+}
+void loop_end(void* user, int worker) { (void)worker; count(user, LOOP_END, 1); }
+void worker_start(void* user, int worker) { (void)worker; count(user, WORKER_START, 1); }
+void worker_stop(void* user, int worker) { (void)worker; count(user, WORKER_STOP, 1); }
+void chunk_begin(void* user, int worker) { (void)worker; count(user, CHUNK_BEGIN, 1); }
+void chunk_end(void* user, int worker, int indexes_run) {
+    (void)worker;
+    count(user, CHUNK_END, 1);
+    count(user, INDEXES_RUN, indexes_run);
+}
+void park(void* user, int worker) { (void)worker; count(user, PARK, 1); }
+void unpark(void* user, int worker) { (void)worker; count(user, UNPARK, 1); }
+
+#define N 10
+
+void inner(int index, void* context) {
+    (void)index; (void)context;
+}
+
+void outer(int index, void* context) {
+    (void)index; (void)context;
+    ct_for(N, inner, 0, 0);
+}
+
+int main() {
+    ct_hooks hooks = {
+        loop_begin, loop_end, worker_start, worker_stop,
+        chunk_begin, chunk_end, park, unpark, 0
+    };
+    int i;
+    ct_set_hooks(&hooks);
+    ct_init(0);
+    ct_for_named("outer", N, outer, 0, 0);
+    ct_fini();
+    ct_set_hooks(0);
+    for(i=0; i<NUM_COUNTS; ++i) {
+        printf("%d%s", counts[i], i == NUM_COUNTS-1 ? "\n" : " ");
+    }
+    return 0;
+}
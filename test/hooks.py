@@ -0,0 +1,14 @@
+# ct_set_hooks: hooks' event counts from 1 loop of 10 indexes spawning 10 loops of 10 indexes
+if 'hooks' in built:
+    for sched in scheds:
+        s, o, c = runtest('hooks',CT_SCHED=sched,CT_THREADS=3)
+        loop_begin, loop_end, worker_start, worker_stop, chunk_begin, chunk_end, indexes_run, park, unpark = \
+            [int(n) for n in o.split('\n')[-1].split()]
+        if (loop_begin, loop_end) != (11, 11):
+            fail(c)
+        elif sched in 'pthreads pshuffle openmp tbb'.split() and \
+             (chunk_begin != chunk_end or chunk_begin < 11 or indexes_run != 110):
+            fail(c)
+        elif sched in 'pthreads pshuffle'.split() and \
+             ((worker_start, worker_stop) != (2, 2) or park != unpark or park < 2):
+            fail(c)
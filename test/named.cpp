@@ -0,0 +1,28 @@
+#include "checkedthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#define RN 10
+#define N (RN*RN)
+#define SCALE 1
+#include "check.h"
+
+#include <math.h>
+volatile double d[N];
+
+/* a named loop spawning loops from an unnamed site, for the instrumentation
+   keyed by loop site ($CT_STATS, $CT_TRACE, $CT_PERF_COUNTERS) */
+int main() {
+    int array[N]={0};
+
+    ct_init(0);
+    ctx_for("outer", RN, [&](int i) {
+        ctx_for(RN, [&](int j) {
+            int ind = i*RN + j;
+            array[ind] = ind;
+            d[ind]=sin((double)i*j) + cos((double)i*j);
+        });
+    });
+    print_and_check_results(array);
+    ct_fini();
+    return 0;
+}
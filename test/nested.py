@@ -19,3 +19,9 @@ for r in [0,1]:
             hadfailures = True
 if verbose and not hadfailures:
   print ' ','expected inter-thread conflicts detected'
+
+# nested_local: the inner iterations own the outer iteration's locals, at
+# stack addresses which the previous outer iterations' inner iterations owned
+s, o, c = runcommand('env CT_SCHED=valgrind valgrind --tool=checkedthreads ./bin/nested_local',expected_status=None)
+if s != 0 or 'owned by' in o or 'results:' not in o:
+    fail(c)
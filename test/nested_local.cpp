@@ -0,0 +1,31 @@
+#include "checkedthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#define RN 10
+#define N (RN*RN)
+#define SCALE 1
+#include "check.h"
+
+/* the inner iterations write an array local to the outer iteration spawning
+   them; the outer iterations run one after another on the same stack, so
+   they reuse the addresses - which shouldn't be reported as conflicts */
+int main() {
+    int array[N]={0};
+
+    ct_init(0);
+    ctx_for(RN, [&](int i) {
+        int local[RN];
+        for(int k=0; k<RN; ++k) {
+            local[k] = -1;
+        }
+        ctx_for(RN, [&](int j) {
+            local[j] = i*RN + j;
+        });
+        for(int k=0; k<RN; ++k) {
+            array[i*RN + k] = local[k];
+        }
+    });
+    print_and_check_results(array);
+    ct_fini();
+    return 0;
+}
@@ -0,0 +1,8 @@
+# CT_PERF_COUNTERS: counts per loop where perf events are permitted, a warning where they aren't
+if 'named' in built:
+    for sched in scheds:
+        s, o, c = runtest('named',CT_SCHED=sched,CT_PERF_COUNTERS='cycles,instructions')
+        loops = [line for line in o.split('\n') if line.startswith('checkedthreads: perf: loop')]
+        if "can't open performance counters" not in o and \
+           (len(loops) != 2 or not any(' outer: 10 indexes, IPC ' in line for line in loops)):
+            fail(c)
@@ -0,0 +1,26 @@
+#include "checkedthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// whatever the order, every index should be visited exactly once
+int sizes[] = { 0, 1, 2, 3, 4, 5, 7, 16, 17, 100, 1000, 4097, 65537, 1024*1024+3 };
+
+int main() {
+    ct_init(0);
+    for(unsigned s=0; s<sizeof sizes/sizeof sizes[0]; ++s) {
+        int n = sizes[s];
+        std::vector<int> visits(n);
+        ctx_for(n, [&](int i) {
+            visits[i]++;
+        });
+        for(int i=0; i<n; ++i) {
+            if(visits[i] != 1) {
+                printf("error: n=%d, index %d visited %d times\n", n, i, visits[i]);
+                exit(1);
+            }
+        }
+    }
+    ct_fini();
+    return 0;
+}
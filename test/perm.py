@@ -0,0 +1,30 @@
+# perm: random orders should visit every index exactly once, and CT_RAND_REV
+# should yield exactly the reverse of the order produced by the same seed
+def verbose_orders(output):
+    orders = []
+    for line in output.split('\n'):
+        if 'entered' in line:
+            orders.append([])
+        elif 'i=' in line:
+            orders[-1].append(int(line.split('i=')[1]))
+    return orders
+
+if 'perm' in built:
+    for sched in scheds:
+        runtest('perm',CT_SCHED=sched)
+        if sched in 'shuffle valgrind'.split():
+            for seed in [1,2**31-1]:
+                runtest('perm',CT_SCHED=sched,CT_RAND_SEED=seed)
+                runtest('perm',CT_SCHED=sched,CT_RAND_SEED=seed,CT_RAND_REV=1)
+    if 'pshuffle' in scheds:
+        runtest('perm',CT_SCHED='pshuffle',CT_RAND_YIELD=10)
+        runtest('perm',CT_SCHED='pshuffle',CT_RAND_REV=1,CT_THREADS=3)
+
+for sched in [s for s in scheds if s in 'shuffle valgrind'.split()]:
+    s1, o1, c1 = runtest('hello_ct',CT_SCHED=sched,CT_VERBOSE=2)
+    s2, o2, c2 = runtest('hello_ct',CT_SCHED=sched,CT_VERBOSE=2,CT_RAND_REV=1)
+    orders1 = verbose_orders(o1)
+    orders2 = verbose_orders(o2)
+    if [list(reversed(order)) for order in orders1] != orders2 or orders1 == orders2:
+        fail(c1)
+        fail(c2)
@@ -0,0 +1,38 @@
+# profile: the work, span and predicted speedups should be consistent, and
+# the loop tree should reflect the program's structure (nested's iterations
+# are too short for their timing to tell much more)
+def profile(output):
+    m = re.search(r'profile: work ([\d.]+) s, span ([\d.]+) s, parallelism ([\d.]+)', output)
+    work, span, par = [float(x) for x in m.groups()]
+    speedups = [[float(x) for x in line.split()] for line in output.split('\n')
+                if re.match(r'^ +\d+ +[\d.]+ +[\d.]+$', line)]
+    loops = [line.split() for line in output.split('\n') if ' loop ' in line]
+    return work, span, par, speedups, loops
+
+def consistent(work, span, par, speedups):
+    return 0 < span <= work and par >= 1 and len(speedups) == 8 and \
+           all(1 <= lower <= upper <= p for p, lower, upper in speedups)
+
+if 'nested' in built:
+    s, o, c = runtest('nested',CT_SCHED='profile')
+    work, span, par, speedups, loops = profile(o)
+    # 10 loops of 10 iterations nested in a loop of 10: loop 1.1 ran 10 times
+    if not consistent(work, span, par, speedups) or [l[-1] for l in loops] != ['1','1.1'] \
+       or loops[1][:2] != ['10','100']:
+        fail(c)
+if 'sort' in built:
+    # the recursion forks 2 calls at each level, so the parallelism is above 1;
+    # partitioning/merging are serial, so it's way below the number of calls
+    s, o, c = runtest('sort',args=str(1024*1024),CT_SCHED='profile')
+    work, span, par, speedups, loops = profile(o)
+    if not consistent(work, span, par, speedups) or not 1.2 < par < 32 or len(loops) < 4:
+        fail(c)
+if 'cancel' in built:
+    # loops are keyed by site, not by f - the 2 plain ctx_for loops (sharing
+    # ctx_for's f) are loops 1 and 2, and find's ctx_invoke, called twice, is loop 3
+    s, o, c = runtest('cancel',CT_SCHED='profile')
+    work, span, par, speedups, loops = profile(o)
+    top = [l for l in loops if '.' not in l[-1]]
+    if not consistent(work, span, par, speedups) or [l[-1] for l in top] != ['1','2','3'] \
+       or [l[0] for l in top] != ['1','1','2']:
+        fail(c)
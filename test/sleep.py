@@ -2,3 +2,11 @@ for sched in scheds:
     if sched not in 'serial shuffle valgrind'.split():
         runtest('sleep',CT_SCHED=sched)
 
+
+# CT_IMBALANCE: the sleeping indexes 1 and 2 make the loop imbalanced over 4 workers
+for sched in scheds:
+    if sched not in 'serial shuffle valgrind'.split():
+        s, o, c = runtest('sleep',CT_SCHED=sched,CT_THREADS=4,CT_IMBALANCE=1.5)
+        warnings = [line for line in o.split('\n') if 'WARNING: imbalanced loop' in line]
+        if len(warnings) != 1 or ' 1 (' not in warnings[0] or ' 2 (' not in warnings[0]:
+            fail(c)
@@ -0,0 +1,15 @@
+# CT_STATS: named runs 1 loop of 10 indexes ("outer") spawning 10 loops of
+# 10 indexes from an unnamed site
+import json
+if 'named' in built:
+    for sched in scheds:
+        s, o, c = runtest('named',CT_SCHED=sched,CT_STATS='json')
+        stats = json.loads(o.split('\n')[-1])
+        sites = sorted([(site['loops'], site['indexes'], site['name'] == 'outer') for site in stats['sites']])
+        if (stats['loops'], stats['indexes'], stats['max_depth']) != (11, 110, 2) or \
+           sites != [(1, 10, True), (10, 100, False)]:
+            fail(c)
+        elif sched in 'pthreads pshuffle'.split() and \
+             (stats['balanced_loops'] != 11 - stats['queue_full'] or stats['max_imbalance'] < 1 or \
+              any(w['busy'] < 0 or w['spin'] < 0 or w['idle'] < 0 for w in stats['workers'])):
+            fail(c)
@@ -0,0 +1,38 @@
+# CT_TRACE: named's 11 loops are traced (the outer one by name), and with pthreads,
+# so are its 110 indexes
+import json
+if 'named' in built:
+    for sched in scheds:
+        s, o, c = runtest('named',CT_SCHED=sched,CT_TRACE='bin/named_trace.json')
+        try:
+            events = json.load(open('bin/named_trace.json'))['traceEvents']
+        except (IOError, ValueError):
+            fail(c)
+            continue
+        loops = [e for e in events if e.get('cat') == 'ct_for']
+        run = sum([e['args']['indexes run'] for e in events if e['name'] == 'indexes' and e['ph'] == 'E'])
+        if len(loops) != 22 or [e['ph'] for e in loops].count('B') != 11 or \
+           [e['name'] for e in loops].count('outer') != 1:
+            fail(c)
+        elif sched in 'pthreads pshuffle'.split() and run != 110:
+            fail(c)
+if 'cancel' in built:
+    # cancel's recursive ctx_invoke calls wrap the buffers around; the E events
+    # whose B events were overwritten are dropped, and the rest are nested
+    for sched in scheds:
+        s, o, c = runtest('cancel',CT_SCHED=sched,CT_TRACE='bin/cancel_trace.json')
+        try:
+            events = json.load(open('bin/cancel_trace.json'))['traceEvents']
+        except (IOError, ValueError):
+            fail(c)
+            continue
+        open_cats = {}
+        nested = len(events) > 1024
+        for e in events:
+            stack = open_cats.setdefault(e.get('tid'), [])
+            if e['ph'] == 'B':
+                stack.append(e['cat'])
+            elif e['ph'] == 'E' and (not stack or stack.pop() != e['cat']):
+                nested = False
+        if not nested:
+            fail(c)
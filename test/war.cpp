@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "checkedthreads.h"
+
+#define N 100
+#define SCALE 3
+
+#include "check.h"
+
+/* a write-after-read race: index 55 writes the input that index 56 reads.
+   the value written is the value read, so the results are right in any order,
+   and only a checker remembering readers finds the race when 56 runs first */
+int main() {
+    int input[N];
+    int array[N]={0};
+    for(int i=0; i<N; ++i) {
+        input[i] = i;
+    }
+
+    ct_init(0);
+    ctx_for(N, [&](int index) {
+        array[index] = input[index]*SCALE;
+        if(index==55) {
+            input[index+1] = index+1;
+        }
+    });
+    print_and_check_results(array);
+    ct_fini();
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/python
+'''benchmarks of the valgrind tool: for each test program, the run time under
+--tool=checkedthreads relative to a native run of the same program (with
+CT_SCHED=valgrind in both cases), and the peak amount of shadow memory
+allocated by the tool (as reported with --stats=yes.)
+
+run from the checkedthreads root directory after make:
+
+./valgrind/bench.py                  # all the benchmarks
+./valgrind/bench.py sort             # the benchmarks of the given tests
+'''
+import sys, os, re, time, commands
+
+# the tests run by test.py (except for bug, which fails by design, and sleep,
+# which mostly sleeps), plus sort on a few input sizes and loop-heavy runs
+# (many iterations doing little work each), where the cost of the per-iteration
+# client requests dominates, and nested-loop-heavy runs (acc with small serial
+# cutoffs, recursing into many small nested loops), where the cost of entering
+# and leaving loops dominates
+benchmarks = [
+    ('hello_ct', ''),
+    ('hello_ctx', ''),
+    ('nested', ''),
+    ('acc', ''),
+    ('cancel', ''),
+    ('grain', ''),
+    ('sort', str(64*1024)),
+    ('sort', str(256*1024)),
+    ('sort', str(1024*1024)),
+    ('grain', '10'),
+    ('perm', ''),
+    ('acc', '4096'),
+    ('acc', '512'),
+]
+
+verbose = int(os.getenv('VERBOSE',0))
+
+def timed(command):
+    if verbose:
+        print ' ','running',command
+    start = time.time()
+    status, output = commands.getstatusoutput(command)
+    finish = time.time()
+    if status != 0:
+        print command,'failed with status',status
+        print output
+        sys.exit(1)
+    return finish - start, output
+
+def stat(output, regexp):
+    m = re.search(regexp, output)
+    return int(m.group(1)) if m else 0
+
+def run(test, args):
+    native, _ = timed('env CT_SCHED=valgrind ./bin/%s %s'%(test,args))
+    checked, output = timed('env CT_SCHED=valgrind valgrind --tool=checkedthreads --stats=yes ./bin/%s %s'%(test,args))
+    return dict(native=native, checked=checked,
+                shadow=stat(output, r'shadow memory: (\d+) bytes peak'),
+                pages=stat(output, r'shadow pages: (\d+) allocated'))
+
+def main():
+    only = sys.argv[1:]
+    print '%-24s %10s %10s %9s %12s %10s'%('benchmark','native(s)','checked(s)','slowdown','shadow(MB)','pages')
+    for test, args in benchmarks:
+        if only and test not in only:
+            continue
+        r = run(test, args)
+        print '%-24s %10.3f %10.3f %8.1fx %12.1f %10d'%(test+' '+args, r['native'], r['checked'],
+                r['checked']/max(r['native'],1e-6), r['shadow']/(1024.*1024), r['pages'])
+
+if __name__ == '__main__':
+    main()
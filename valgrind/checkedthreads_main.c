@@ -24,6 +24,15 @@
 #include "pub_tool_threadstate.h"
 #include "pub_tool_stacktrace.h"
 #include "pub_tool_debuginfo.h"
+#include "pub_tool_execontext.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_oset.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_vki.h"
+#include "valgrind.h"             // VG_USERREQ_TOOL_BASE
+#if defined(VGA_amd64)
+#include "libvex_guest_amd64.h"   // the argument registers
+#endif
 #include <stdint.h>
 
 /*------------------------------------------------------------*/
@@ -35,9 +44,37 @@
 static Bool clo_trace_mem       = True;
 static Bool clo_print_commands  = False;
 
+#define SKIP_STACK_NO    0
+#define SKIP_STACK_SP    1
+#define SKIP_STACK_SP_FP 2
+static Int  clo_skip_stack      = SKIP_STACK_SP;
+
+#define CHECK_WRITES 0
+#define CHECK_ALL    1
+static Int  clo_check_level     = CHECK_ALL;
+static double clo_check_sample  = 1.0;
+static Bool clo_track_readers   = True;
+static Bool clo_report_false_sharing = False;
+static Char* clo_footprint_file = 0;
+
 static Bool ct_process_cmd_line_option(Char* arg)
 {
+   Char* str;
    if VG_BOOL_CLO(arg, "--print-commands", clo_print_commands) {}
+   else if VG_XACT_CLO(arg, "--skip-stack-accesses=no", clo_skip_stack, SKIP_STACK_NO) {}
+   else if VG_XACT_CLO(arg, "--skip-stack-accesses=sp", clo_skip_stack, SKIP_STACK_SP) {}
+   else if VG_XACT_CLO(arg, "--skip-stack-accesses=sp-fp", clo_skip_stack, SKIP_STACK_SP_FP) {}
+   else if VG_XACT_CLO(arg, "--check-level=writes", clo_check_level, CHECK_WRITES) {}
+   else if VG_XACT_CLO(arg, "--check-level=all", clo_check_level, CHECK_ALL) {}
+   else if VG_STR_CLO(arg, "--check-sample", str) {
+      Char* end;
+      clo_check_sample = VG_(strtod)(str, &end);
+      if (*end || !(clo_check_sample > 0 && clo_check_sample <= 1))
+         VG_(fmsg_bad_option)(arg, "--check-sample expects a fraction in (0,1]\n");
+   }
+   else if VG_BOOL_CLO(arg, "--track-readers", clo_track_readers) {}
+   else if VG_BOOL_CLO(arg, "--report-false-sharing", clo_report_false_sharing) {}
+   else if VG_STR_CLO(arg, "--footprint-report", clo_footprint_file) {}
    else
       return False;
    return True;
@@ -48,6 +85,25 @@ static void ct_print_usage(void)
    VG_(printf)(
 "    --print-commands=no|yes   print commands issued by the checkedtheads\n"
 "                              runtime [no]\n"
+"    --skip-stack-accesses=no|sp|sp-fp  skip the checks of accesses at a small\n"
+"                              offset from the stack pointer (or also the frame\n"
+"                              pointer, which may be a general-purpose register\n"
+"                              in code compiled without frame pointers) when\n"
+"                              they're in the running iteration's frames [sp]\n"
+"    --check-level=writes|all  check just stores, or loads as well [all]\n"
+"    --check-sample=P          check a random fraction P of the iterations\n"
+"                              (chosen by $CT_RAND_SEED); in the rest, stores\n"
+"                              change ownership without being checked [1]\n"
+"    --track-readers=no|yes    remember who read each location, so that a\n"
+"                              store conflicting with an earlier load is found\n"
+"                              as well as a load conflicting with an earlier\n"
+"                              store, whatever the order of iterations [yes]\n"
+"    --report-false-sharing=no|yes  summarize at exit the cache lines where\n"
+"                              different iterations of a loop wrote different\n"
+"                              bytes, by allocation site and stack [no]\n"
+"    --footprint-report=<file>  write histograms of the bytes each checked\n"
+"                              iteration reads, writes and shares with other\n"
+"                              iterations, per ct_for call site, as JSON [none]\n"
    );
 }
 
@@ -73,6 +129,7 @@ typedef
       EventKind  ekind;
       IRAtom*    addr;
       Int        size;
+      Bool       stack; /* at SP/FP plus a constant: checked against stackbot */
    }
    Event;
 
@@ -111,21 +168,21 @@ typedef
 static Event events[N_EVENTS];
 static Int   events_used = 0;
 
-#define MAGIC 0x12345678
-#define CONST_MAGIC "Valgrind command"
-#define MAX_CMD 128
-
-typedef struct {
-    volatile uint32_t stored_magic;
-    const char const_magic[16];
-    volatile char payload[MAX_CMD];
-} ct_cmd;
-
-static ct_cmd* g_ct_last_cmd = 0; /* ignore writes to cmd */
+/* client requests issued by the checkedthreads runtime (src/valgrind_imp.c);
+   the codes must match the ones there. */
+typedef enum {
+   CT_USERREQ_BEGIN_FOR = VG_USERREQ_TOOL_BASE('C','T'), /* arg1: stack bottom */
+   CT_USERREQ_END_FOR,
+   CT_USERREQ_ITER, /* arg1: thread ID, arg2: index */
+   CT_USERREQ_DONE, /* arg1: index */
+   CT_USERREQ_GET_OWNER, /* arg1: address */
+   CT_USERREQ_SET_SEED /* arg1: $CT_RAND_SEED */
+} ct_userreq;
 
 /* 3-level page table; up to 2^36 pages of 2^12 bytes each,
-   organized into levels of up to 2^12 entries each.
-   should work fine for virtual addresses of up to 48 bits. */
+   organized into levels of up to 2^12 entries each - covering
+   virtual addresses of up to 48 bits (ADDR_BITS). accesses above
+   that (such as the amd64 vsyscall page) aren't checked. */
 #define PAGE_BITS 12
 #define PAGE_SIZE (1<<PAGE_BITS)
 #define L1_BITS 12
@@ -135,26 +192,66 @@ static ct_cmd* g_ct_last_cmd = 0; /* ignore writes to cmd */
 #define L3_BITS 12
 #define NUM_L2_PAGETABS (1<<L3_BITS)
 
-#define L2_PAGETAB(addr) ((((UInt)addr >> 24) >> 12) & 0xfff)
-#define L1_PAGETAB(addr) (((UInt)addr >> 24) & 0xfff)
-#define PAGE(addr) (((UInt)addr >> 12) & 0xfff)
-#define BYTE_IN_PAGE(addr) ((UInt)addr & 0xfff)
+#define ADDR_BITS (PAGE_BITS+L1_BITS+L2_BITS+L3_BITS)
 
-#define OWNER_INACCESSIBLE 0xff /* inaccessible memory - "owned" by thread 255 which is never the current thread. */
+/* the index computations are done on ULong so that the shifts are
+   well-defined (and don't drop the high bits) on 32 and 64-bit hosts alike */
+#define L2_PAGETAB(addr) ((UInt)(((ULong)(addr) >> (PAGE_BITS+L1_BITS+L2_BITS)) & (NUM_L2_PAGETABS-1)))
+#define L1_PAGETAB(addr) ((UInt)(((ULong)(addr) >> (PAGE_BITS+L1_BITS)) & (NUM_L1_PAGETABS-1)))
+#define PAGE(addr) ((UInt)(((ULong)(addr) >> PAGE_BITS) & (NUM_PAGES-1)))
+#define BYTE_IN_PAGE(addr) ((UInt)((addr) & (PAGE_SIZE-1)))
+#define IS_TRACKED(addr) (((ULong)(addr) >> ADDR_BITS) == 0)
 
-/* owning_thread[] is a summary of all levels up to this one; if
-   owning_thread[i]==0, perhaps indeed the location is owned by nobody -
+#define OWNER_INACCESSIBLE 0xff /* inaccessible memory - "owned" by thread 255 which is never the current thread. */
+#define READER_SHARED 0xfe /* read by several threads - thread IDs go up to 253 */
+
+/* a page's owners are kept at one of 3 granularities: a single owner for
+   the whole page, an owner per aligned 8-byte word, or an owner per byte.
+   pages start out with a single owner, and are promoted to a finer
+   granularity when a store covers a part of a unit of the current
+   granularity with a different owner. a store to a whole page demotes
+   it back to a single owner. */
+#define WORD_BITS 3
+#define WORD_SIZE (1<<WORD_BITS)
+#define WORDS_PER_PAGE (PAGE_SIZE>>WORD_BITS)
+
+#define GRAN_PAGE 0
+#define GRAN_WORD 1
+#define GRAN_BYTE 2
+
+#define BITS_PER_UWORD (8*sizeof(UWord))
+#define DIRTY_UWORDS (PAGE_SIZE/BITS_PER_UWORD)
+
+/* the owners are a summary of all levels up to this one; if the owner
+   of a location is 0, perhaps indeed the location is owned by nobody -
    and perhaps it's owned by a thread who spawned the current for.
 
-   dirty_owners[i], if non-zero, is always equal to owning_thread[i]
-   (since they're updated simultaneously), and it means that the ownership
-   was obtained in the current for, and must be committed to the spawner's
-   page table when this for quits. */
+   a set bit in dirty[] means that the ownership of the location was
+   obtained in the current for (so the location's owner is the one who
+   obtained it), and must be committed to the spawner's page table when
+   this for quits.
+
+   a page of a nested level starts out sharing the owners of the spawner's
+   page (copy-on-write): its owners are those of the shared page, except
+   for the threads in hidden[] (the spawners), which own nothing at this
+   level. the page gets its own owners when it's first stored to.
+
+   with --track-readers, readers is a page of the same kind, whose "owners"
+   are the threads who read the locations (or READER_SHARED); it's allocated
+   when the page is first accessed. */
+#define MAX_HIDDEN 4
+
 typedef struct ct_page_ {
     /* 0 means "owned by none" (so is OK to access).
        the rest means "owned by i" (so is OK to access for i only.) */
-    unsigned char owning_thread[PAGE_SIZE];
-    unsigned char* dirty_owners; /* PAGE_SIZE entries, when allocated. */
+    unsigned char gran; /* GRAN_PAGE, GRAN_WORD or GRAN_BYTE */
+    unsigned char owner; /* at GRAN_PAGE */
+    unsigned char nhidden;
+    unsigned char hidden[MAX_HIDDEN];
+    unsigned char* owners; /* WORDS_PER_PAGE or PAGE_SIZE entries at GRAN_WORD/GRAN_BYTE */
+    UWord* dirty; /* PAGE_SIZE bits, when allocated. */
+    struct ct_page_* shared; /* a page of an enclosing level (itself not shared), or 0 */
+    struct ct_page_* readers; /* with --track-readers, or 0 */
     Addr base_address;
     /* we keep a linked a list of allocated pages so as to not have
        to traverse all indexes to find allocated pages. */
@@ -176,46 +273,441 @@ typedef struct ct_pagetab_L2_ {
 typedef struct ct_pagetab_L3_ {
     ct_pagetab_L2* pagetabs_L2[NUM_L2_PAGETABS];
     ct_pagetab_L2* last_alloc_pagetab_L2;
+    struct ct_pagetab_L3_* next_free_pagetab_L3;
 } ct_pagetab_L3;
 
 typedef struct ct_pagetab_stack_entry_ {
     ct_pagetab_L3* pagetab_L3;
     int thread;
     int active;
+    int checked;
+    UInt loop_id;
     char* stackbot;
     struct ct_pagetab_stack_entry_* next_stack_entry;
 } ct_pagetab_stack_entry;
 
-static Bool g_ct_active = False;
+static Bool g_ct_active = False; /* inside an iteration: stores change ownership */
+static Bool g_ct_checked = True; /* the iteration is checked (see --check-sample) */
+static Bool g_ct_checking_loads = False; /* g_ct_active && g_ct_checked */
+static UInt g_ct_loop_id = 0; /* the number of loops entered before the current one */
+static UInt g_ct_num_loops = 0;
 static ct_pagetab_stack_entry* g_ct_pagetab_stack = 0;
 static ct_pagetab_L3* g_ct_pagetab_L3 = 0; /* top/curr pagetab */
 static Int g_ct_curr_thread = 0; /* top/curr thread */
 static char* g_ct_stackbot = 0;
 static char* g_ct_stackend = 0;
 
-static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, int readonly_pagetab);
+/* shadow memory accounting, printed at exit with --stats=yes */
+static SizeT g_ct_shadow_bytes = 0;
+static SizeT g_ct_peak_shadow_bytes = 0;
+static ULong g_ct_pages_allocated = 0;
+static ULong g_ct_pages_shared = 0;
+static ULong g_ct_pages_refined[3] = {0,0,0}; /* indexed by the granularity refined to */
 
-static void ct_init_ownership(ct_page* page)
+static void* ct_shadow_calloc(const HChar* cc, SizeT size)
 {
-    if(g_ct_pagetab_stack == 0 || g_ct_pagetab_stack->pagetab_L3 == 0) {
-        return;
+    g_ct_shadow_bytes += size;
+    if(g_ct_shadow_bytes > g_ct_peak_shadow_bytes) {
+        g_ct_peak_shadow_bytes = g_ct_shadow_bytes;
+    }
+    return VG_(calloc)(cc, 1, size);
+}
+
+static void ct_shadow_free(void* p, SizeT size)
+{
+    g_ct_shadow_bytes -= size;
+    VG_(free)(p);
+}
+
+/* page tables, pages and dirty bitmaps released when a level is popped
+   are kept for reuse by the next levels. they're cleared when released
+   (page tables entry by entry, as their pages are released), so reusing
+   them doesn't require clearing all of a 32K page table. */
+static ct_pagetab_L3* g_ct_free_pagetabs_L3 = 0;
+static ct_pagetab_L2* g_ct_free_pagetabs_L2 = 0;
+static ct_pagetab_L1* g_ct_free_pagetabs_L1 = 0;
+static ct_page* g_ct_free_pages = 0;
+static UWord* g_ct_free_dirty = 0; /* linked through their first word */
+
+static ct_pagetab_L3* ct_alloc_pagetab_L3(void)
+{
+    ct_pagetab_L3* pagetab_L3 = g_ct_free_pagetabs_L3;
+    if(pagetab_L3 == 0) {
+        return (ct_pagetab_L3*)ct_shadow_calloc("pagetab_L3", sizeof(ct_pagetab_L3));
+    }
+    g_ct_free_pagetabs_L3 = pagetab_L3->next_free_pagetab_L3;
+    pagetab_L3->next_free_pagetab_L3 = 0;
+    return pagetab_L3;
+}
+
+static ct_pagetab_L2* ct_alloc_pagetab_L2(void)
+{
+    ct_pagetab_L2* pagetab_L2 = g_ct_free_pagetabs_L2;
+    if(pagetab_L2 == 0) {
+        return (ct_pagetab_L2*)ct_shadow_calloc("pagetab_L2", sizeof(ct_pagetab_L2));
+    }
+    g_ct_free_pagetabs_L2 = pagetab_L2->prev_alloc_pagetab_L2;
+    pagetab_L2->prev_alloc_pagetab_L2 = 0;
+    return pagetab_L2;
+}
+
+static ct_pagetab_L1* ct_alloc_pagetab_L1(void)
+{
+    ct_pagetab_L1* pagetab_L1 = g_ct_free_pagetabs_L1;
+    if(pagetab_L1 == 0) {
+        return (ct_pagetab_L1*)ct_shadow_calloc("pagetab_L1", sizeof(ct_pagetab_L1));
+    }
+    g_ct_free_pagetabs_L1 = pagetab_L1->prev_alloc_pagetab_L1;
+    pagetab_L1->prev_alloc_pagetab_L1 = 0;
+    return pagetab_L1;
+}
+
+static ct_page* ct_alloc_page(void)
+{
+    ct_page* page = g_ct_free_pages;
+    g_ct_pages_allocated++;
+    if(page == 0) {
+        return (ct_page*)ct_shadow_calloc("page", sizeof(ct_page));
+    }
+    g_ct_free_pages = page->prev_alloc_page;
+    page->prev_alloc_page = 0;
+    return page;
+}
+
+static UWord* ct_alloc_dirty(void)
+{
+    UWord* dirty = g_ct_free_dirty;
+    if(dirty == 0) {
+        return (UWord*)ct_shadow_calloc("dirty", PAGE_SIZE/8);
     }
-    ct_page* spawner_page = ct_get_page(page->base_address, g_ct_pagetab_stack->pagetab_L3, 1);
-    if(spawner_page == 0) {
+    g_ct_free_dirty = (UWord*)dirty[0];
+    dirty[0] = 0;
+    return dirty;
+}
+
+static void ct_release_dirty(UWord* dirty)
+{
+    VG_(memset)(dirty, 0, PAGE_SIZE/8);
+    dirty[0] = (UWord)g_ct_free_dirty;
+    g_ct_free_dirty = dirty;
+}
+
+static SizeT ct_owners_size(int gran)
+{
+    return gran == GRAN_WORD ? WORDS_PER_PAGE : PAGE_SIZE;
+}
+
+static inline int ct_private_page_owner(ct_page* page, int index_in_page)
+{
+    switch(page->gran) {
+        case GRAN_PAGE: return page->owner;
+        case GRAN_WORD: return page->owners[index_in_page >> WORD_BITS];
+        default: return page->owners[index_in_page];
+    }
+}
+
+static inline int ct_page_owner(ct_page* page, int index_in_page)
+{
+    if(UNLIKELY(page->shared != 0)) {
+        int owner = ct_private_page_owner(page->shared, index_in_page), k;
+        for(k=0; k<page->nhidden; ++k) {
+            if(owner == page->hidden[k]) {
+                return 0;
+            }
+        }
+        return owner;
+    }
+    return ct_private_page_owner(page, index_in_page);
+}
+
+/* switch to a finer granularity, keeping the owners */
+static void ct_page_refine(ct_page* page, int gran)
+{
+    unsigned char* owners = (unsigned char*)ct_shadow_calloc("owners", ct_owners_size(gran));
+    if(page->gran == GRAN_PAGE) {
+        VG_(memset)(owners, page->owner, ct_owners_size(gran));
+    }
+    else { /* GRAN_WORD -> GRAN_BYTE */
+        int w;
+        for(w=0; w<WORDS_PER_PAGE; ++w) {
+            VG_(memset)(owners + (w << WORD_BITS), page->owners[w], WORD_SIZE);
+        }
+        ct_shadow_free(page->owners, ct_owners_size(page->gran));
+    }
+    page->owners = owners;
+    page->gran = gran;
+    g_ct_pages_refined[gran]++;
+}
+
+static void ct_page_set_owners(ct_page* page, int from, int len, unsigned char owner)
+{
+    Bool word_aligned = ((from | len) & (WORD_SIZE-1)) == 0;
+    if(len == PAGE_SIZE) { /* back to a single owner */
+        if(page->gran != GRAN_PAGE) {
+            ct_shadow_free(page->owners, ct_owners_size(page->gran));
+            page->owners = 0;
+            page->gran = GRAN_PAGE;
+        }
+        page->owner = owner;
         return;
     }
-    int spawner_thread = g_ct_pagetab_stack->thread;
+    if(page->gran == GRAN_PAGE) {
+        if(page->owner == owner) {
+            return;
+        }
+        ct_page_refine(page, word_aligned ? GRAN_WORD : GRAN_BYTE);
+    }
+    if(page->gran == GRAN_WORD) {
+        int w, first_w = from >> WORD_BITS, last_w = (from + len - 1) >> WORD_BITS;
+        if(word_aligned) {
+            VG_(memset)(page->owners + first_w, owner, last_w - first_w + 1);
+            return;
+        }
+        for(w=first_w; w<=last_w && page->owners[w] == owner; ++w);
+        if(w > last_w) { /* nothing changes */
+            return;
+        }
+        ct_page_refine(page, GRAN_BYTE);
+    }
+    VG_(memset)(page->owners + from, owner, len);
+}
+
+/* owners are compared a machine word at a time ("SIMD within a register"):
+   a word of owners is OK for a thread if each of its bytes is either 0
+   or equal to the thread (or to one of the hidden threads.) */
+#define ONE_BYTES (~(UWord)0 / 0xff) /* 0x0101...01 */
+#define HIGH_BITS (ONE_BYTES * 0x80)
+#define LOW_BITS (ONE_BYTES * 0x7f)
+
+/* 0x80 in every byte of v which is 0, and 0 in the other bytes */
+static inline UWord ct_zero_bytes(UWord v)
+{
+    return ~(((v & LOW_BITS) + LOW_BITS) | v | LOW_BITS);
+}
+
+static inline Bool ct_is_foreign(int owner, int thread, const unsigned char* hidden, int nhidden)
+{
+    int k;
+    if(owner == 0 || owner == thread) {
+        return False;
+    }
+    for(k=0; k<nhidden; ++k) {
+        if(owner == hidden[k]) {
+            return False;
+        }
+    }
+    return True;
+}
+
+/* returns the index of the first entry in owners[from,to) which is
+   neither 0 nor thread nor hidden, or -1 if there's no such entry */
+static int ct_find_foreign_owner(const unsigned char* owners, int from, int to, int thread,
+                                 const unsigned char* hidden, int nhidden)
+{
+    UWord thread_bytes = ONE_BYTES * (UWord)thread;
+    UWord hidden_bytes[MAX_HIDDEN];
+    int i = from, k;
+    for(k=0; k<nhidden; ++k) {
+        hidden_bytes[k] = ONE_BYTES * (UWord)hidden[k];
+    }
+    for(; i < to && i % sizeof(UWord); ++i) {
+        if(ct_is_foreign(owners[i], thread, hidden, nhidden)) {
+            return i;
+        }
+    }
+    for(; i + (int)sizeof(UWord) <= to; i += sizeof(UWord)) {
+        UWord w = *(const UWord*)(owners + i);
+        UWord ok = ct_zero_bytes(w) | ct_zero_bytes(w ^ thread_bytes);
+        for(k=0; k<nhidden; ++k) {
+            ok |= ct_zero_bytes(w ^ hidden_bytes[k]);
+        }
+        if(ok != HIGH_BITS) {
+            break; /* the loop below will find the foreign owner */
+        }
+    }
+    for(; i < to; ++i) {
+        if(ct_is_foreign(owners[i], thread, hidden, nhidden)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* returns the index of the first location in [from,to) owned by
+   neither 0 nor thread, or -1 if there's no such location */
+static inline int ct_page_find_foreign(ct_page* page, int from, int to, int thread)
+{
+    ct_page* owners_page = page->shared ? page->shared : page; /* nhidden is 0 if not shared */
     int i;
-    for(i=0; i<PAGE_SIZE; ++i) {
-        int spawner_owner = spawner_page->owning_thread[i];
-        if(spawner_owner != spawner_thread) {
-            page->owning_thread[i] = spawner_owner;
+    if(from >= to) {
+        return -1;
+    }
+    switch(owners_page->gran) {
+        case GRAN_PAGE:
+            return ct_is_foreign(owners_page->owner, thread, page->hidden, page->nhidden) ? from : -1;
+        case GRAN_WORD:
+            i = ct_find_foreign_owner(owners_page->owners, from >> WORD_BITS, ((to-1) >> WORD_BITS) + 1,
+                                      thread, page->hidden, page->nhidden);
+            if(i < 0) {
+                return -1;
+            }
+            return i << WORD_BITS > from ? i << WORD_BITS : from;
+        default:
+            return ct_find_foreign_owner(owners_page->owners, from, to, thread, page->hidden, page->nhidden);
+    }
+}
+
+/* gives a shared page its own owners (the shared page's owners, with 0
+   in place of the hidden threads), a word at a time */
+static void ct_page_unshare(ct_page* page)
+{
+    ct_page* shared = page->shared;
+    UWord hidden_bytes[MAX_HIDDEN];
+    SizeT i, n;
+    int k;
+    page->shared = 0;
+    page->gran = shared->gran;
+    if(shared->gran == GRAN_PAGE) {
+        page->owner = ct_is_foreign(shared->owner, 0, page->hidden, page->nhidden) ? shared->owner : 0;
+        page->nhidden = 0;
+        return;
+    }
+    for(k=0; k<page->nhidden; ++k) {
+        hidden_bytes[k] = ONE_BYTES * (UWord)page->hidden[k];
+    }
+    n = ct_owners_size(shared->gran);
+    page->owners = (unsigned char*)ct_shadow_calloc("owners", n);
+    for(i=0; i<n; i+=sizeof(UWord)) {
+        UWord w = *(const UWord*)(shared->owners + i);
+        for(k=0; k<page->nhidden; ++k) {
+            /* 0x80 -> 0xff in the bytes equal to the hidden thread */
+            w &= ~((ct_zero_bytes(w ^ hidden_bytes[k]) >> 7) * 0xff);
         }
-        /* otherwise, don't copy ownership - it's OK to access that location */
+        *(UWord*)(page->owners + i) = w;
     }
+    page->nhidden = 0;
 }
 
-static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, int readonly_pagetab)
+static void ct_set_dirty(ct_page* page, int from, int len)
+{
+    int i = from, to = from + len;
+    if(!page->dirty) {
+        page->dirty = ct_alloc_dirty();
+    }
+    while(i < to) {
+        int bit = i % BITS_PER_UWORD;
+        int nbits = BITS_PER_UWORD - bit < to - i ? BITS_PER_UWORD - bit : to - i;
+        UWord mask = nbits == BITS_PER_UWORD ? ~(UWord)0 : (((UWord)1 << nbits) - 1) << bit;
+        page->dirty[i / BITS_PER_UWORD] |= mask;
+        i += nbits;
+    }
+}
+
+/* a store of [from,from+len) by thread */
+static void ct_page_store(ct_page* page, int from, int len, int thread)
+{
+    if(page->shared) {
+        if(len == PAGE_SIZE) { /* no need for a copy of owners about to be overwritten */
+            page->shared = 0;
+            page->nhidden = 0;
+        }
+        else {
+            ct_page_unshare(page);
+        }
+    }
+    ct_page_set_owners(page, from, len, thread);
+    ct_set_dirty(page, from, len);
+}
+
+/* entry is the stack entry of pagetab_L3's level, holding its spawner's
+   page table, which the level's new pages inherit their owners from */
+static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, ct_pagetab_stack_entry* entry,
+                            int readonly_pagetab);
+
+/* use the spawner's ownership, except for locations owned by the spawner -
+   it's OK to access those, so they're owned by none at this level */
+static void ct_inherit_owners(ct_page* page, ct_page* spawner_page, int spawner_thread)
+{
+    if(spawner_page->shared && spawner_page->nhidden == MAX_HIDDEN) {
+        ct_page_unshare(spawner_page); /* same owners, represented privately */
+    }
+    if(spawner_page->shared) {
+        page->shared = spawner_page->shared;
+        VG_(memcpy)(page->hidden, spawner_page->hidden, spawner_page->nhidden);
+        page->nhidden = spawner_page->nhidden;
+        page->hidden[page->nhidden++] = spawner_thread;
+        g_ct_pages_shared++;
+    }
+    else if(spawner_page->gran == GRAN_PAGE) {
+        page->owner = spawner_page->owner == spawner_thread ? 0 : spawner_page->owner;
+    }
+    else {
+        page->shared = spawner_page;
+        page->hidden[0] = spawner_thread;
+        page->nhidden = 1;
+        g_ct_pages_shared++;
+    }
+}
+
+/* the spawner's page is created if the spawner's level never accessed it,
+   so that it inherits from its own spawner in turn */
+static ct_page* ct_get_spawner_page(Addr a, ct_pagetab_stack_entry* entry)
+{
+    if(entry == 0 || entry->pagetab_L3 == 0) {
+        return 0;
+    }
+    return ct_get_page(a, entry->pagetab_L3, entry->next_stack_entry, 0);
+}
+
+static void ct_init_ownership(ct_page* page, ct_pagetab_stack_entry* entry)
+{
+    ct_page* spawner_page = ct_get_spawner_page(page->base_address, entry);
+    if(spawner_page) {
+        ct_inherit_owners(page, spawner_page, entry->thread);
+    }
+}
+
+static ct_page* ct_page_readers(ct_page* page, ct_pagetab_stack_entry* entry)
+{
+    if(!page->readers) {
+        ct_page* spawner_page = ct_get_spawner_page(page->base_address, entry);
+        page->readers = ct_alloc_page();
+        page->readers->base_address = page->base_address;
+        if(spawner_page) {
+            ct_inherit_owners(page->readers, ct_page_readers(spawner_page, entry->next_stack_entry),
+                              entry->thread);
+        }
+    }
+    return page->readers;
+}
+
+/* a load of [from,from+len) by thread: locations read by none (or by thread
+   alone) become read by thread, and the others are read by several threads */
+static void ct_page_read(ct_page* page, ct_pagetab_stack_entry* entry, int from, int len, int thread)
+{
+    ct_page* readers = ct_page_readers(page, entry);
+    int to = from + len;
+    if(readers->gran == GRAN_PAGE && !readers->shared && readers->owner == READER_SHARED) {
+        return;
+    }
+    while(from < to) {
+        int i = ct_page_find_foreign(readers, from, to, thread);
+        int end = i < 0 ? to : i;
+        if(end > from) {
+            ct_page_store(readers, from, end - from, thread);
+        }
+        if(i < 0) {
+            return;
+        }
+        if(ct_page_owner(readers, i) != READER_SHARED) {
+            ct_page_store(readers, i, 1, READER_SHARED);
+        }
+        from = i + 1;
+    }
+}
+
+static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, ct_pagetab_stack_entry* entry,
+                            int readonly_pagetab)
 {
     ct_pagetab_L2* pagetab_L2;
     ct_pagetab_L1* pagetab_L1;
@@ -225,7 +717,7 @@ static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, int readonly_page
     pagetab_L2 = pagetab_L3->pagetabs_L2[pt2_index];
     if(pagetab_L2 == 0) {
         if(readonly_pagetab) return 0;
-        pagetab_L2 = (ct_pagetab_L2*)VG_(calloc)("pagetab_L2", 1, sizeof(ct_pagetab_L2));
+        pagetab_L2 = ct_alloc_pagetab_L2();
         pagetab_L2->prev_alloc_pagetab_L2 = pagetab_L3->last_alloc_pagetab_L2; 
         pagetab_L3->last_alloc_pagetab_L2 = pagetab_L2;
         pagetab_L3->pagetabs_L2[pt2_index] = pagetab_L2;
@@ -235,7 +727,7 @@ static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, int readonly_page
     pagetab_L1 = pagetab_L2->pagetabs_L1[pt1_index];
     if(pagetab_L1 == 0) {
         if(readonly_pagetab) return 0;
-        pagetab_L1 = (ct_pagetab_L1*)VG_(calloc)("pagetab_L1", 1, sizeof(ct_pagetab_L1));
+        pagetab_L1 = ct_alloc_pagetab_L1();
         pagetab_L1->prev_alloc_pagetab_L1 = pagetab_L2->last_alloc_pagetab_L1;
         pagetab_L2->last_alloc_pagetab_L1 = pagetab_L1;
         pagetab_L2->pagetabs_L1[pt1_index] = pagetab_L1;
@@ -245,17 +737,55 @@ static ct_page* ct_get_page(Addr a, ct_pagetab_L3* pagetab_L3, int readonly_page
     page = pagetab_L1->pages[page_index];
     if(page == 0) {
         if(readonly_pagetab) return 0;
-        page = (ct_page*)VG_(calloc)("page", 1, sizeof(ct_page));
+        page = ct_alloc_page();
         page->base_address = a - BYTE_IN_PAGE(a);
         page->prev_alloc_page = pagetab_L1->last_alloc_page;
         pagetab_L1->last_alloc_page = page;
         pagetab_L1->pages[page_index] = page;
 
-        ct_init_ownership(page);
+        ct_init_ownership(page, entry);
     }
     return page;
 }
 
+/* a direct-mapped cache of the current level's pages (a "TLB"), so that
+   most accesses don't walk the page table. pages are only freed when
+   a level is popped, so it's enough to flush the cache when the current
+   page table changes. */
+#define TLB_BITS 8
+#define TLB_SIZE (1<<TLB_BITS)
+
+typedef struct {
+    Addr base_address;
+    ct_page* page;
+} ct_tlb_entry;
+
+static ct_tlb_entry g_ct_tlb[TLB_SIZE];
+
+static void ct_flush_tlb(void)
+{
+    VG_(memset)(g_ct_tlb, 0, sizeof(g_ct_tlb));
+}
+
+static inline ct_page* ct_get_curr_page(Addr a)
+{
+    Addr base_address = a & ~(Addr)(PAGE_SIZE-1);
+    ct_tlb_entry* entry = &g_ct_tlb[(a >> PAGE_BITS) & (TLB_SIZE-1)];
+    if(LIKELY(entry->page && entry->base_address == base_address)) {
+        return entry->page;
+    }
+    entry->page = ct_get_page(a, g_ct_pagetab_L3, g_ct_pagetab_stack, 0);
+    entry->base_address = base_address;
+    return entry->page;
+}
+
+static void ct_set_active(Bool active, Bool checked)
+{
+    g_ct_active = active;
+    g_ct_checked = checked;
+    g_ct_checking_loads = active && checked;
+}
+
 static void ct_push_pagetab(void)
 {
     ct_pagetab_stack_entry* entry = (ct_pagetab_stack_entry*)VG_(calloc)("pagetab_stack_entry", 1, sizeof(ct_pagetab_stack_entry));
@@ -263,82 +793,206 @@ static void ct_push_pagetab(void)
     entry->pagetab_L3 = g_ct_pagetab_L3;
     entry->thread = g_ct_curr_thread;
     entry->active = g_ct_active;
+    entry->checked = g_ct_checked;
+    entry->loop_id = g_ct_loop_id;
     entry->stackbot = g_ct_stackbot;
     entry->next_stack_entry = g_ct_pagetab_stack;
 
     g_ct_pagetab_stack = entry;
 
-    g_ct_pagetab_L3 = (ct_pagetab_L3*)VG_(calloc)("pagetab_L3", 1, sizeof(ct_pagetab_L3));
+    g_ct_pagetab_L3 = ct_alloc_pagetab_L3();
+    ct_flush_tlb();
 }
 
-static void ct_commit_ownership(ct_page* page)
+/* returns the first index >= i whose dirty bit is set (or clear, if set
+   is False), or PAGE_SIZE if there's none */
+static int ct_next_dirty(const UWord* dirty, int i, Bool set)
 {
-    if(!page->dirty_owners || g_ct_pagetab_stack == 0 || g_ct_pagetab_stack->pagetab_L3 == 0) {
+    while(i < PAGE_SIZE) {
+        UWord w = dirty[i / BITS_PER_UWORD];
+        if(!set) {
+            w = ~w;
+        }
+        w >>= i % BITS_PER_UWORD;
+        if(w == 0) {
+            i = (i / BITS_PER_UWORD + 1) * BITS_PER_UWORD;
+            continue;
+        }
+        while(!(w & 1)) {
+            w >>= 1;
+            ++i;
+        }
+        return i;
+    }
+    return PAGE_SIZE;
+}
+
+/* returns the first index in owners[from,to) which is equal to owner
+   (or unequal, if equal is False), or to if there's none */
+static int ct_find_owner(const unsigned char* owners, int from, int to, int owner, Bool equal)
+{
+    UWord owner_bytes = ONE_BYTES * (UWord)owner;
+    int i = from;
+    for(; i < to && i % sizeof(UWord); ++i) {
+        if((owners[i] == owner) == equal) {
+            return i;
+        }
+    }
+    for(; i + (int)sizeof(UWord) <= to; i += sizeof(UWord)) {
+        UWord eq = ct_zero_bytes(*(const UWord*)(owners + i) ^ owner_bytes);
+        if(equal ? eq != 0 : eq != HIGH_BITS) {
+            break;
+        }
+    }
+    for(; i < to; ++i) {
+        if((owners[i] == owner) == equal) {
+            return i;
+        }
+    }
+    return to;
+}
+
+/* no matter who owned the dirty locations [from,to) in this loop, they're
+   now owned by the loop spawner - "joining" means "as if we never forked".
+   inaccessible memory is a special case - it stays inaccessible after the join. */
+static void ct_commit_run(ct_page* spawner_page, ct_page* page, int from, int to, int spawner_thread)
+{
+    int shift = page->gran == GRAN_WORD ? WORD_BITS : 0;
+    if(page->gran == GRAN_PAGE) {
+        ct_page_store(spawner_page, from, to - from,
+                      page->owner == OWNER_INACCESSIBLE ? OWNER_INACCESSIBLE : spawner_thread);
         return;
     }
-    /* FIXME: we need parent pointers in page tables or something - instead of these globals...
-       because here, for instance, ct_get_page may fiddle with g_ct_pagetab_stack itself in init_ownership. */
-    ct_page* spawner_page = ct_get_page(page->base_address, g_ct_pagetab_stack->pagetab_L3, 0);
-    if(!spawner_page->dirty_owners) {
-        spawner_page->dirty_owners = VG_(calloc)("dirty_owners", 1, PAGE_SIZE);
+    while(from < to) {
+        Bool inaccessible = ct_page_owner(page, from) == OWNER_INACCESSIBLE;
+        int end = ct_find_owner(page->owners, from >> shift, ((to-1) >> shift) + 1,
+                                OWNER_INACCESSIBLE, !inaccessible) << shift;
+        if(end > to) {
+            end = to;
+        }
+        ct_page_store(spawner_page, from, end - from, inaccessible ? OWNER_INACCESSIBLE : spawner_thread);
+        from = end;
     }
-    int curr_thread = g_ct_curr_thread;
-    int i;
-    for(i=0; i<PAGE_SIZE; ++i) {
-        /* no matter who owned the location in this loop, the location now
-           is owned by the loop spawner - "joining" means "as if we never forked" */
-        int owner = page->dirty_owners[i];
-        if(owner) {
-            /* inaccessible memory is a special case - it stays inaccessible after the join. */
-            int joined_owner = owner == OWNER_INACCESSIBLE ? owner : curr_thread;
-            spawner_page->dirty_owners[i] = joined_owner;
-            spawner_page->owning_thread[i] = joined_owner;
+}
+
+/* the locations [from,to) read in this loop were read by the loop spawner
+   (the ones with no readers were freed in this loop, and aren't committed) */
+static void ct_commit_reads(ct_page* spawner_page, ct_pagetab_stack_entry* spawner_entry,
+                            ct_page* readers, int from, int to, int spawner_thread)
+{
+    int shift = readers->gran == GRAN_WORD ? WORD_BITS : 0;
+    if(readers->gran == GRAN_PAGE) {
+        if(readers->owner) {
+            ct_page_read(spawner_page, spawner_entry, from, to - from, spawner_thread);
         }
+        return;
+    }
+    while(from < to) {
+        Bool read = ct_page_owner(readers, from) != 0;
+        int end = ct_find_owner(readers->owners, from >> shift, ((to-1) >> shift) + 1, 0, read) << shift;
+        if(end > to) {
+            end = to;
+        }
+        if(read) {
+            ct_page_read(spawner_page, spawner_entry, from, end - from, spawner_thread);
+        }
+        from = end;
+    }
+}
+
+/* entry is the stack entry of the popped level */
+static void ct_commit_ownership(ct_page* page, ct_pagetab_stack_entry* entry)
+{
+    ct_page* readers = page->readers;
+    ct_pagetab_stack_entry* spawner_entry = entry->next_stack_entry;
+    int spawner_thread = entry->thread;
+    ct_page* spawner_page;
+    int from;
+    if(entry->pagetab_L3 == 0 || !(page->dirty || (readers && readers->dirty))) {
+        return;
+    }
+    spawner_page = ct_get_page(page->base_address, entry->pagetab_L3, spawner_entry, 0);
+    /* commit runs of dirty locations (so that whole ranges are stored,
+       keeping the spawner's page as coarse as possible) */
+    from = page->dirty ? ct_next_dirty(page->dirty, 0, True) : PAGE_SIZE;
+    while(from < PAGE_SIZE) {
+        int to = ct_next_dirty(page->dirty, from, False);
+        ct_commit_run(spawner_page, page, from, to, spawner_thread);
+        from = ct_next_dirty(page->dirty, to, True);
+    }
+    from = readers && readers->dirty ? ct_next_dirty(readers->dirty, 0, True) : PAGE_SIZE;
+    while(from < PAGE_SIZE) {
+        int to = ct_next_dirty(readers->dirty, from, False);
+        ct_commit_reads(spawner_page, spawner_entry, readers, from, to, spawner_thread);
+        from = ct_next_dirty(readers->dirty, to, True);
     }
 }
 
+static void ct_release_page(ct_page* page)
+{
+    if(page->dirty) {
+        ct_release_dirty(page->dirty);
+    }
+    if(page->owners) {
+        ct_shadow_free(page->owners, ct_owners_size(page->gran));
+    }
+    if(page->readers) {
+        ct_release_page(page->readers);
+    }
+    VG_(memset)(page, 0, sizeof(ct_page));
+    page->prev_alloc_page = g_ct_free_pages;
+    g_ct_free_pages = page;
+}
+
 static void ct_pop_pagetab(void)
 {
+    ct_pagetab_stack_entry* entry = g_ct_pagetab_stack;
     ct_pagetab_L3* pagetab_L3 = g_ct_pagetab_L3;
     ct_pagetab_L2* pagetab_L2 = pagetab_L3->last_alloc_pagetab_L2;
 
-    g_ct_curr_thread = g_ct_pagetab_stack->thread;
+    g_ct_pagetab_stack = entry->next_stack_entry;
+    g_ct_pagetab_L3 = entry->pagetab_L3;
+    g_ct_curr_thread = entry->thread;
 
-    /* free all L2 pages */
+    /* release all L2 pages */
     while(pagetab_L2) {
         ct_pagetab_L2* prev_pagetab_L2 = pagetab_L2->prev_alloc_pagetab_L2;
-        /* free all L1 pages */
+        /* release all L1 pages */
         ct_pagetab_L1* pagetab_L1 = pagetab_L2->last_alloc_pagetab_L1;
         while(pagetab_L1) {
             ct_pagetab_L1* prev_pagetab_L1 = pagetab_L1->prev_alloc_pagetab_L1;
-            /* free all pages */
+            /* release all pages */
             ct_page* page = pagetab_L1->last_alloc_page;
             while(page) {
                 ct_page* prev_page = page->prev_alloc_page;
-                if(page->dirty_owners) {
-                    ct_commit_ownership(page);
-                    VG_(free)(page->dirty_owners);
-                }
-                VG_(free)(page);
+                Addr a = page->base_address;
+                ct_commit_ownership(page, entry);
+                ct_release_page(page);
+                /* clear the entries pointing to the released tables */
+                pagetab_L1->pages[PAGE(a)] = 0;
+                pagetab_L2->pagetabs_L1[L1_PAGETAB(a)] = 0;
+                pagetab_L3->pagetabs_L2[L2_PAGETAB(a)] = 0;
                 page = prev_page;
             }
-            /* free the L1 pagetab */
-            VG_(free)(pagetab_L1);
+            pagetab_L1->last_alloc_page = 0;
+            pagetab_L1->prev_alloc_pagetab_L1 = g_ct_free_pagetabs_L1;
+            g_ct_free_pagetabs_L1 = pagetab_L1;
             pagetab_L1 = prev_pagetab_L1;
         }
-        /* free the L2 pagetab */
-        VG_(free)(pagetab_L2);
+        pagetab_L2->last_alloc_pagetab_L1 = 0;
+        pagetab_L2->prev_alloc_pagetab_L2 = g_ct_free_pagetabs_L2;
+        g_ct_free_pagetabs_L2 = pagetab_L2;
         pagetab_L2 = prev_pagetab_L2;
     }
-    VG_(free)(pagetab_L3);
-
-    g_ct_pagetab_L3 = g_ct_pagetab_stack->pagetab_L3;
-    g_ct_active = g_ct_pagetab_stack->active;
-    g_ct_stackbot = g_ct_pagetab_stack->stackbot;
-
-    ct_pagetab_stack_entry* entry = g_ct_pagetab_stack->next_stack_entry;
-    VG_(free)(g_ct_pagetab_stack);
-    g_ct_pagetab_stack = entry;
+    pagetab_L3->last_alloc_pagetab_L2 = 0;
+    pagetab_L3->next_free_pagetab_L3 = g_ct_free_pagetabs_L3;
+    g_ct_free_pagetabs_L3 = pagetab_L3;
+
+    ct_flush_tlb();
+    ct_set_active(entry->active, entry->checked);
+    g_ct_loop_id = entry->loop_id;
+    g_ct_stackbot = entry->stackbot;
+    VG_(free)(entry);
 }
 
 static char* ct_stack_end(void)
@@ -347,24 +1001,109 @@ static char* ct_stack_end(void)
     return (char*)(VG_(thread_get_stack_max)(tid) - VG_(thread_get_stack_size)(tid));
 }
 
-/* reuse (abuse?) of the page table structure to keep permanently suppressed addresses. */
-static ct_pagetab_L3 g_ct_supp_L3;
+/* the .got, .plt and .got.plt sections of the loaded objects, where the
+   dynamic loader's writes aren't reported: sorted, disjoint ranges, rebuilt
+   (on the next apparent violation) after objects are mapped or unmapped. */
+typedef struct {
+    Addr start;
+    Addr end;
+} ct_range;
+
+static ct_range* g_ct_supp_ranges = 0;
+static Int g_ct_num_supp_ranges = 0;
+static Int g_ct_max_supp_ranges = 0;
+static Bool g_ct_supp_ranges_stale = True;
 
-static void ct_suppress_forever(Addr addr)
+static void ct_add_supp_range(Addr start, SizeT size)
 {
-    ct_pagetab_stack_entry* real_stack = g_ct_pagetab_stack;
-    g_ct_pagetab_stack = 0; //TODO: this is too ugly... prevents "ownership initialization".
-    ct_page* page = ct_get_page(addr, &g_ct_supp_L3, 0); 
-    g_ct_pagetab_stack = real_stack;
+    if(size == 0) {
+        return;
+    }
+    if(g_ct_num_supp_ranges == g_ct_max_supp_ranges) {
+        g_ct_max_supp_ranges = g_ct_max_supp_ranges ? 2*g_ct_max_supp_ranges : 64;
+        g_ct_supp_ranges = (ct_range*)VG_(realloc)("supp_ranges", g_ct_supp_ranges,
+                g_ct_max_supp_ranges * sizeof(ct_range));
+    }
+    g_ct_supp_ranges[g_ct_num_supp_ranges].start = start;
+    g_ct_supp_ranges[g_ct_num_supp_ranges].end = start + size;
+    g_ct_num_supp_ranges++;
+}
 
-    int index_in_page = BYTE_IN_PAGE(addr);
-    page->owning_thread[index_in_page] = 1; /* in this page table, a non-zero value means "suppressed" */
+static Int ct_cmp_ranges(void* p1, void* p2)
+{
+    Addr s1 = ((ct_range*)p1)->start, s2 = ((ct_range*)p2)->start;
+    return s1 < s2 ? -1 : (s1 > s2 ? 1 : 0);
 }
 
-static Bool ct_is_supressed_forever(Addr addr)
+static void ct_build_supp_ranges(void)
 {
-    ct_page* page = ct_get_page(addr, &g_ct_supp_L3, 1);
-    return page && page->owning_thread[BYTE_IN_PAGE(addr)];
+    const DebugInfo* di;
+    Int i, n = 0;
+    g_ct_num_supp_ranges = 0;
+    for(di = VG_(next_DebugInfo)(NULL); di; di = VG_(next_DebugInfo)(di)) {
+        ct_add_supp_range(VG_(DebugInfo_get_got_avma)(di), VG_(DebugInfo_get_got_size)(di));
+        ct_add_supp_range(VG_(DebugInfo_get_plt_avma)(di), VG_(DebugInfo_get_plt_size)(di));
+        ct_add_supp_range(VG_(DebugInfo_get_gotplt_avma)(di), VG_(DebugInfo_get_gotplt_size)(di));
+    }
+    if(g_ct_num_supp_ranges > 0) {
+        VG_(ssort)(g_ct_supp_ranges, g_ct_num_supp_ranges, sizeof(ct_range), ct_cmp_ranges);
+        /* merge overlapping and adjacent ranges (.got is often followed by .got.plt) */
+        for(i=1; i<g_ct_num_supp_ranges; ++i) {
+            if(g_ct_supp_ranges[i].start <= g_ct_supp_ranges[n].end) {
+                if(g_ct_supp_ranges[i].end > g_ct_supp_ranges[n].end) {
+                    g_ct_supp_ranges[n].end = g_ct_supp_ranges[i].end;
+                }
+            }
+            else {
+                g_ct_supp_ranges[++n] = g_ct_supp_ranges[i];
+            }
+        }
+        g_ct_num_supp_ranges = n+1;
+    }
+    g_ct_supp_ranges_stale = False;
+}
+
+static Bool ct_in_supp_range(Addr addr)
+{
+    Int lo = 0, hi;
+    if(g_ct_supp_ranges_stale) {
+        ct_build_supp_ranges();
+    }
+    hi = g_ct_num_supp_ranges;
+    while(lo < hi) {
+        Int mid = lo + (hi - lo)/2;
+        if(addr < g_ct_supp_ranges[mid].start) {
+            hi = mid;
+        }
+        else if(addr >= g_ct_supp_ranges[mid].end) {
+            lo = mid + 1;
+        }
+        else {
+            return True;
+        }
+    }
+    return False;
+}
+
+/* libc's mem* functions, found in its symbol table (see ct_mem_function) */
+static Bool g_ct_memfn_ranges_stale = True;
+static Addr g_ct_memfn_text_start = 0, g_ct_memfn_text_end = 0; /* the text containing them */
+
+/* objects (and their debug info) come and go with mappings */
+static void ct_new_mem_mapped(Addr a, SizeT len, Bool rr, Bool ww, Bool xx, ULong di_handle)
+{
+    g_ct_supp_ranges_stale = True;
+    if(xx) {
+        g_ct_memfn_ranges_stale = True;
+    }
+}
+
+static void ct_die_mem_munmap(Addr a, SizeT len)
+{
+    g_ct_supp_ranges_stale = True;
+    if(a < g_ct_memfn_text_end && a + len > g_ct_memfn_text_start) {
+        g_ct_memfn_ranges_stale = True;
+    }
 }
 
 static Bool ct_suppress(Addr addr)
@@ -381,146 +1120,692 @@ static Bool ct_suppress(Addr addr)
             return True;
         }
     }
-    /* ignore permanent suppressions. */
-    if(ct_is_supressed_forever(addr)) {
+    /* ignore changes to .got/.plt/.got.plt */
+    if(ct_in_supp_range(addr)) {
         return True;
     }
-    /* ignore writes to the command object. */
-    if(p >= (char*)g_ct_last_cmd && p < (char*)(g_ct_last_cmd+1)) {
-        ct_suppress_forever(addr);
-        return True;
+
+    return False;
+}
+
+/* --report-false-sharing: a store to a cache line where another iteration
+   of the current loop stored to other bytes (which the owners tell, at the
+   locations obtained in the current loop, marked by the dirty bits) is
+   attributed to a site - the heap block the line is in, if any, and the
+   stack of the first such store to the line in the loop. */
+#define LINE_BITS 6
+#define LINE_SIZE (1<<LINE_BITS)
+
+typedef struct {
+    Addr start;
+    SizeT size;
+    ExeContext* where;
+} ct_block;
+
+typedef struct ct_fs_site_ {
+    ExeContext* alloc_where; /* 0 outside heap blocks */
+    ExeContext* store_where;
+    ULong lines; /* distinct lines, counting each once per loop */
+    ULong stores;
+    struct ct_fs_site_* next; /* in g_ct_fs_sites[] */
+} ct_fs_site;
+
+typedef struct ct_fs_line_ {
+    struct ct_fs_line_* next;
+    UWord key; /* the line address - the first 2 fields are a VgHashNode */
+    UInt loop_id;
+    ct_fs_site* site;
+} ct_fs_line;
+
+#define FS_SITE_BUCKETS 1024
+
+static OSet* g_ct_blocks = 0; /* heap blocks, when reporting false sharing */
+static VgHashTable g_ct_fs_lines = 0;
+static ct_fs_site* g_ct_fs_sites[FS_SITE_BUCKETS];
+static ULong g_ct_fs_num_sites = 0;
+
+/* a block "equals" the addresses it contains */
+static Word ct_cmp_block(const void* key, const void* elem)
+{
+    Addr a = *(const Addr*)key;
+    const ct_block* block = (const ct_block*)elem;
+    if(a < block->start) return -1;
+    if(a >= block->start + (block->size ? block->size : 1)) return 1;
+    return 0;
+}
+
+static void ct_record_block(Addr start, SizeT size)
+{
+    ct_block* block;
+    if(!g_ct_blocks) {
+        g_ct_blocks = VG_(OSetGen_Create)(offsetof(ct_block, start), ct_cmp_block,
+                                          VG_(malloc), "ct.blocks", VG_(free));
     }
-    /* ignore changes to .got/.plt/.got.plt */
-    VgSectKind kind = VG_(DebugInfo_sect_kind)(NULL, 0, addr);
-    if(kind == Vg_SectGOT || kind == Vg_SectPLT || kind == Vg_SectGOTPLT) {
-        ct_suppress_forever(addr);
-        return True;
+    block = (ct_block*)VG_(OSetGen_AllocNode)(g_ct_blocks, sizeof(ct_block));
+    block->start = start;
+    block->size = size;
+    block->where = VG_(record_ExeContext)(VG_(get_running_tid)(), 0);
+    VG_(OSetGen_Insert)(g_ct_blocks, block);
+}
+
+static void ct_forget_block(Addr start)
+{
+    ct_block* block = g_ct_blocks ? (ct_block*)VG_(OSetGen_Remove)(g_ct_blocks, &start) : 0;
+    if(block) {
+        VG_(OSetGen_FreeNode)(g_ct_blocks, block);
+    }
+}
+
+static ct_fs_site* ct_get_fs_site(ExeContext* alloc_where, ExeContext* store_where)
+{
+    UWord h = ((UWord)alloc_where ^ ((UWord)store_where >> 3)) % FS_SITE_BUCKETS;
+    ct_fs_site* site;
+    for(site = g_ct_fs_sites[h]; site; site = site->next) {
+        if(site->alloc_where == alloc_where && site->store_where == store_where) {
+            return site;
+        }
     }
+    site = (ct_fs_site*)VG_(calloc)("ct.fs_site", 1, sizeof(ct_fs_site));
+    site->alloc_where = alloc_where;
+    site->store_where = store_where;
+    site->next = g_ct_fs_sites[h];
+    g_ct_fs_sites[h] = site;
+    g_ct_fs_num_sites++;
+    return site;
+}
 
+/* the block is looked up by the stored address, since a line may start
+   before the block */
+static void ct_false_sharing(Addr line_addr, Addr addr)
+{
+    ct_fs_line* line;
+    if(!g_ct_fs_lines) {
+        g_ct_fs_lines = VG_(HT_construct)("ct.fs_lines");
+    }
+    line = (ct_fs_line*)VG_(HT_lookup)(g_ct_fs_lines, line_addr);
+    if(!line) {
+        line = (ct_fs_line*)VG_(calloc)("ct.fs_line", 1, sizeof(ct_fs_line));
+        line->key = line_addr;
+        VG_(HT_add_node)(g_ct_fs_lines, line);
+    }
+    if(!line->site || line->loop_id != g_ct_loop_id) {
+        ct_block* block = g_ct_blocks ? (ct_block*)VG_(OSetGen_Lookup)(g_ct_blocks, &addr) : 0;
+        line->loop_id = g_ct_loop_id;
+        line->site = ct_get_fs_site(block ? block->where : 0,
+                                    VG_(record_ExeContext)(VG_(get_running_tid)(), 0));
+        line->site->lines++;
+    }
+    line->site->stores++;
+}
+
+/* whether another iteration of the current loop stored to [from,to) */
+static Bool ct_stored_by_other(ct_page* page, int from, int to, int thread)
+{
+    int i = from;
+    if(!page->dirty) {
+        return False;
+    }
+    while(i < to && (i = ct_page_find_foreign(page, i, to, thread)) >= 0) {
+        if((page->dirty[i / BITS_PER_UWORD] >> (i % BITS_PER_UWORD)) & 1
+           && ct_page_owner(page, i) != OWNER_INACCESSIBLE) {
+            return True;
+        }
+        ++i;
+    }
     return False;
 }
 
-static inline void ct_on_access(Addr base, SizeT size, Bool store, Bool report_errors)
+static void ct_check_false_sharing(ct_page* page, Addr page_base, int from, int to, int thread)
 {
-    SizeT i;
-    ct_pagetab_L3* pagetab_L3 = g_ct_pagetab_L3;
-    int curr_thread = g_ct_curr_thread;
-    for(i=0; i<size; ++i) {
-        Addr addr = base+i;
-        ct_page* page = ct_get_page(addr, pagetab_L3, 0);
-        int index_in_page = BYTE_IN_PAGE(addr);
-        int owner = page->owning_thread[index_in_page];
-        if(owner && owner != curr_thread) {
-            if(report_errors && !ct_suppress(addr)) {
-                VG_(printf)("checkedthreads: error - thread %d accessed %p [%p,%d], owned by %d\n",
-                        g_ct_curr_thread-1,
-                        (void*)addr, (void*)base, (int)size,
-                        owner-1);
-                VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 20);
-                break;
-            }
+    int line;
+    for(line = from & ~(LINE_SIZE-1); line < to; line += LINE_SIZE) {
+        int line_end = line + LINE_SIZE;
+        int start = from > line ? from : line;
+        if(ct_stored_by_other(page, line, start, thread) ||
+           ct_stored_by_other(page, to < line_end ? to : line_end, line_end, thread)) {
+            ct_false_sharing(page_base + line, page_base + start);
+        }
+    }
+}
+
+static Int ct_cmp_fs_sites(void* p1, void* p2)
+{
+    const ct_fs_site* s1 = *(const ct_fs_site**)p1;
+    const ct_fs_site* s2 = *(const ct_fs_site**)p2;
+    if(s1->stores != s2->stores) return s1->stores > s2->stores ? -1 : 1;
+    return s1->lines > s2->lines ? -1 : s1->lines < s2->lines;
+}
+
+#define MAX_FS_SITES_SHOWN 20
+
+static void ct_print_false_sharing(void)
+{
+    ct_fs_site** sites;
+    Int i, n = 0;
+    VG_(printf)("checkedthreads: false sharing: %llu sites\n", g_ct_fs_num_sites);
+    if(g_ct_fs_num_sites == 0) {
+        return;
+    }
+    sites = (ct_fs_site**)VG_(malloc)("ct.fs_sites", g_ct_fs_num_sites * sizeof(ct_fs_site*));
+    for(i = 0; i < FS_SITE_BUCKETS; i++) {
+        ct_fs_site* site;
+        for(site = g_ct_fs_sites[i]; site; site = site->next) {
+            sites[n++] = site;
+        }
+    }
+    VG_(ssort)(sites, n, sizeof(ct_fs_site*), ct_cmp_fs_sites);
+    for(i = 0; i < n && i < MAX_FS_SITES_SHOWN; i++) {
+        VG_(printf)("checkedthreads: false sharing #%d: %llu stores to %llu cache lines written by other iterations, at\n",
+                i+1, sites[i]->stores, sites[i]->lines);
+        VG_(pp_ExeContext)(sites[i]->store_where);
+        if(sites[i]->alloc_where) {
+            VG_(printf)("checkedthreads: in a block allocated at\n");
+            VG_(pp_ExeContext)(sites[i]->alloc_where);
+        }
+    }
+    if(n > MAX_FS_SITES_SHOWN) {
+        VG_(printf)("checkedthreads: (%d more sites not shown)\n", n - MAX_FS_SITES_SHOWN);
+    }
+    VG_(free)(sites);
+}
+
+/* --footprint-report: the distinct bytes read, written and shared with
+   other iterations of the same loop by each checked iteration (including
+   the loops it spawns), kept as byte masks of the cache lines it accessed;
+   the sharing is only known once all the iterations ran, so the iterations'
+   lines are saved until the end of the loop. */
+#define FP_READ    0
+#define FP_WRITTEN 1
+#define FP_SHARED  2
+#define FP_NSTATS  3
+#define FP_BINS 41 /* bin 0 counts zeros, bin k>0 counts values in [2^(k-1),2^k) */
+
+typedef struct {
+    ULong min, max, total;
+    ULong hist[FP_BINS];
+} ct_fp_stat;
+
+typedef struct ct_fp_site_ {
+    ExeContext* where; /* of the loop's BEGIN_FOR */
+    ULong loops;
+    ULong iters;
+    ct_fp_stat stats[FP_NSTATS];
+    struct ct_fp_site_* next; /* in g_ct_fp_sites[] */
+} ct_fp_site;
+
+typedef struct ct_fp_line_ {
+    struct ct_fp_line_* next;
+    UWord key; /* the line address */
+    ULong read, written; /* a bit per byte (LINE_SIZE is 64) */
+    ULong multi; /* in a loop's lines: accessed by several iterations */
+} ct_fp_line;
+
+typedef struct {
+    Addr line;
+    ULong mask;
+} ct_fp_saved_line;
+
+typedef struct {
+    SizeT end; /* of the iteration's lines in ct_fp_loop.saved */
+    ULong read, written;
+} ct_fp_iter;
+
+typedef struct ct_fp_loop_ {
+    ct_fp_site* site;
+    VgHashTable iter_lines; /* of the running iteration, 0 if none or unchecked */
+    VgHashTable lines; /* of the finished iterations */
+    ct_fp_saved_line* saved;
+    SizeT nsaved, saved_size;
+    ct_fp_iter* iters;
+    SizeT niters, iters_size;
+    struct ct_fp_loop_* parent;
+} ct_fp_loop;
+
+static ct_fp_loop* g_ct_fp_loop = 0;
+static ct_fp_site* g_ct_fp_sites[FS_SITE_BUCKETS];
+static ULong g_ct_fp_num_sites = 0;
+
+static UInt ct_popcount(ULong x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (UInt)((x * 0x0101010101010101ULL) >> 56);
+}
+
+/* makes room for n+1 elements of elem_size bytes */
+static void* ct_fp_grow(void* array, SizeT* size, SizeT n, SizeT elem_size)
+{
+    if(n < *size) {
+        return array;
+    }
+    *size = *size ? *size * 2 : 64;
+    return VG_(realloc)("ct.fp_array", array, *size * elem_size);
+}
+
+static ct_fp_line* ct_fp_get_line(VgHashTable lines, Addr line_addr)
+{
+    ct_fp_line* line = (ct_fp_line*)VG_(HT_lookup)(lines, line_addr);
+    if(!line) {
+        line = (ct_fp_line*)VG_(calloc)("ct.fp_line", 1, sizeof(ct_fp_line));
+        line->key = line_addr;
+        VG_(HT_add_node)(lines, line);
+    }
+    return line;
+}
+
+static ct_fp_site* ct_get_fp_site(ExeContext* where)
+{
+    UWord h = ((UWord)where >> 3) % FS_SITE_BUCKETS;
+    ct_fp_site* site;
+    for(site = g_ct_fp_sites[h]; site; site = site->next) {
+        if(site->where == where) {
+            return site;
         }
+    }
+    site = (ct_fp_site*)VG_(calloc)("ct.fp_site", 1, sizeof(ct_fp_site));
+    site->where = where;
+    site->next = g_ct_fp_sites[h];
+    g_ct_fp_sites[h] = site;
+    g_ct_fp_num_sites++;
+    return site;
+}
+
+static void ct_fp_access(Addr base, SizeT size, Bool store)
+{
+    VgHashTable lines = g_ct_fp_loop->iter_lines;
+    Addr end = base + size;
+    Addr line_addr;
+    if((char*)base >= g_ct_stackend && (char*)base < g_ct_stackbot) {
+        return; /* the iteration's stack frames */
+    }
+    for(line_addr = base & ~(Addr)(LINE_SIZE-1); line_addr < end; line_addr += LINE_SIZE) {
+        int from = base > line_addr ? (int)(base - line_addr) : 0;
+        int to = end - line_addr < LINE_SIZE ? (int)(end - line_addr) : LINE_SIZE;
+        ULong mask = (to - from == 64 ? ~0ULL : (1ULL << (to - from)) - 1) << from;
+        ct_fp_line* line = ct_fp_get_line(lines, line_addr);
         if(store) {
-            /* update the owner */
-            page->owning_thread[index_in_page] = curr_thread;
-            if(!page->dirty_owners) {
-                page->dirty_owners = (unsigned char*)VG_(calloc)("dirty_owners", 1, PAGE_SIZE);
-            }
-            page->dirty_owners[index_in_page] = curr_thread;
+            line->written |= mask;
+        }
+        else {
+            line->read |= mask;
         }
     }
 }
 
-static Bool ct_str_is(volatile const char* variable, const char* constant)
+static void ct_fp_begin_loop(ThreadId tid)
 {
-    int i=0;
-    while(constant[i]) {
-        if(variable[i] != constant[i]) {
-            return False;
+    ct_fp_loop* loop = (ct_fp_loop*)VG_(calloc)("ct.fp_loop", 1, sizeof(ct_fp_loop));
+    loop->site = ct_get_fp_site(VG_(record_ExeContext)(tid, 0));
+    loop->lines = VG_(HT_construct)("ct.fp_lines");
+    loop->parent = g_ct_fp_loop;
+    g_ct_fp_loop = loop;
+}
+
+static void ct_fp_end_iter(ct_fp_loop* loop)
+{
+    ct_fp_iter* iter;
+    ct_fp_line* line;
+    if(!loop->iter_lines) {
+        return;
+    }
+    loop->iters = (ct_fp_iter*)ct_fp_grow(loop->iters, &loop->iters_size, loop->niters, sizeof(ct_fp_iter));
+    iter = &loop->iters[loop->niters++];
+    iter->read = iter->written = 0;
+    VG_(HT_ResetIter)(loop->iter_lines);
+    while((line = (ct_fp_line*)VG_(HT_Next)(loop->iter_lines)) != 0) {
+        ULong mask = line->read | line->written;
+        ct_fp_line* all = ct_fp_get_line(loop->lines, line->key);
+        iter->read += ct_popcount(line->read);
+        iter->written += ct_popcount(line->written);
+        all->multi |= (all->read | all->written) & mask;
+        all->read |= line->read;
+        all->written |= line->written;
+        loop->saved = (ct_fp_saved_line*)ct_fp_grow(loop->saved, &loop->saved_size, loop->nsaved,
+                                                    sizeof(ct_fp_saved_line));
+        loop->saved[loop->nsaved].line = line->key;
+        loop->saved[loop->nsaved].mask = mask;
+        loop->nsaved++;
+    }
+    iter->end = loop->nsaved;
+    VG_(HT_destruct)(loop->iter_lines, VG_(free));
+    loop->iter_lines = 0;
+}
+
+static void ct_fp_begin_iter(void)
+{
+    ct_fp_loop* loop = g_ct_fp_loop;
+    ct_fp_end_iter(loop);
+    if(g_ct_checked) {
+        loop->iter_lines = VG_(HT_construct)("ct.fp_iter_lines");
+    }
+}
+
+static void ct_fp_record(ct_fp_stat* stat, ULong value, Bool first)
+{
+    int bin = 0;
+    while(bin < FP_BINS-1 && (value >> bin) != 0) {
+        ++bin;
+    }
+    stat->hist[bin]++;
+    stat->total += value;
+    if(first || value < stat->min) stat->min = value;
+    if(first || value > stat->max) stat->max = value;
+}
+
+static void ct_fp_end_loop(void)
+{
+    ct_fp_loop* loop = g_ct_fp_loop;
+    ct_fp_loop* parent = loop->parent;
+    ct_fp_site* site = loop->site;
+    ct_fp_line* line;
+    SizeT i, j = 0;
+    ct_fp_end_iter(loop);
+    site->loops++;
+    for(i = 0; i < loop->niters; ++i) {
+        ULong shared = 0;
+        for(; j < loop->iters[i].end; ++j) {
+            ct_fp_line* all = (ct_fp_line*)VG_(HT_lookup)(loop->lines, loop->saved[j].line);
+            shared += ct_popcount(loop->saved[j].mask & all->multi);
         }
-        ++i;
+        ct_fp_record(&site->stats[FP_READ], loop->iters[i].read, site->iters == 0);
+        ct_fp_record(&site->stats[FP_WRITTEN], loop->iters[i].written, site->iters == 0);
+        ct_fp_record(&site->stats[FP_SHARED], shared, site->iters == 0);
+        site->iters++;
     }
-    return True;
+    /* what the loop accessed was accessed by the spawning iteration */
+    VG_(HT_ResetIter)(loop->lines);
+    while((line = (ct_fp_line*)VG_(HT_Next)(loop->lines)) != 0) {
+        if(parent && parent->iter_lines) {
+            ct_fp_line* spawner_line = ct_fp_get_line(parent->iter_lines, line->key);
+            spawner_line->read |= line->read;
+            spawner_line->written |= line->written;
+        }
+    }
+    VG_(HT_destruct)(loop->lines, VG_(free));
+    if(loop->saved) VG_(free)(loop->saved);
+    if(loop->iters) VG_(free)(loop->iters);
+    VG_(free)(loop);
+    g_ct_fp_loop = parent;
+}
+
+static Int g_ct_fp_fd = -1;
+
+static void ct_fp_printf(const HChar* format, ...)
+{
+    HChar buf[512];
+    va_list vargs;
+    va_start(vargs, format);
+    VG_(vsnprintf)(buf, sizeof buf, format, vargs);
+    va_end(vargs);
+    VG_(write)(g_ct_fp_fd, buf, VG_(strlen)(buf));
 }
 
-static Addr ct_cmd_ptr(ct_cmd* cmd, int oft)
+/* a JSON string: debug info names may contain quotes or backslashes */
+static void ct_fp_print_str(const HChar* str)
 {
-    return *(Addr*)&cmd->payload[oft];
+    HChar buf[256*2+3];
+    Int n = 0;
+    buf[n++] = '"';
+    for(; *str && n < (Int)sizeof buf - 3; ++str) {
+        if(*str == '"' || *str == '\\') {
+            buf[n++] = '\\';
+        }
+        buf[n++] = (UChar)*str < ' ' ? '?' : *str;
+    }
+    buf[n++] = '"';
+    VG_(write)(g_ct_fp_fd, buf, n);
 }
 
-static Int ct_cmd_int(ct_cmd* cmd, int oft)
+static void ct_fp_print_stat(const HChar* name, ct_fp_stat* stat, ULong iters)
 {
-    return *(volatile int32_t*)&cmd->payload[oft];
+    int i, nbins = FP_BINS;
+    while(nbins > 1 && stat->hist[nbins-1] == 0) {
+        --nbins;
+    }
+    ct_fp_printf(",\n     \"%s\": {\"min\": %llu, \"max\": %llu, \"mean\": %llu, \"hist\": [",
+                 name, stat->min, stat->max, iters ? stat->total / iters : 0);
+    for(i = 0; i < nbins; ++i) {
+        ct_fp_printf(i ? ", %llu" : "%llu", stat->hist[i]);
+    }
+    ct_fp_printf("]}");
 }
 
-static void ct_process_command(ct_cmd* cmd)
+static void ct_fp_print_site(ct_fp_site* site)
 {
-    if(!ct_str_is(cmd->const_magic, CONST_MAGIC)) {
+    Addr* ips = VG_(get_ExeContext_StackTrace)(site->where);
+    Int i, n = VG_(get_ExeContext_n_ips)(site->where);
+    ct_fp_printf("    {\"stack\": [");
+    for(i = 0; i < n; ++i) {
+        Addr ip = ips[i];
+        HChar fn[256], file[256], dir[256];
+        Bool has_dir;
+        UInt line;
+        ct_fp_printf("%s{\"ip\": \"%#lx\"", i ? ",\n               " : "", (unsigned long)ip);
+        if(VG_(get_fnname)(ip, fn, sizeof fn)) {
+            ct_fp_printf(", \"fn\": ");
+            ct_fp_print_str(fn);
+        }
+        /* the frames above the first hold return addresses - look up the call */
+        if(VG_(get_filename_linenum)(i ? ip - 1 : ip, file, sizeof file, dir, sizeof dir, &has_dir, &line)) {
+            ct_fp_printf(", \"file\": ");
+            ct_fp_print_str(file);
+            ct_fp_printf(", \"line\": %u", line);
+        }
+        ct_fp_printf("}");
+    }
+    ct_fp_printf("],\n     \"loops\": %llu, \"iterations\": %llu", site->loops, site->iters);
+    ct_fp_print_stat("read", &site->stats[FP_READ], site->iters);
+    ct_fp_print_stat("written", &site->stats[FP_WRITTEN], site->iters);
+    ct_fp_print_stat("shared", &site->stats[FP_SHARED], site->iters);
+    ct_fp_printf("}");
+}
+
+static void ct_fp_write_report(void)
+{
+    HChar* name = VG_(expand_file_name)("--footprint-report", clo_footprint_file);
+    SysRes sres = VG_(open)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY, VKI_S_IRUSR|VKI_S_IWUSR);
+    Int i, n = 0;
+    if(sr_isError(sres)) {
+        VG_(umsg)("error: can't open footprint report file '%s'\n", name);
+        VG_(free)(name);
         return;
     }
-    if(ct_str_is(cmd->payload, "begin_for")) {
-        if(clo_print_commands) VG_(printf)("begin_for\n");
-        ct_push_pagetab();
+    g_ct_fp_fd = (Int)sr_Res(sres);
+    ct_fp_printf("{\"unit\": \"bytes\", \"hist_bins\": \"0, then [2^(k-1),2^k) for k>0\",\n"
+                 " \"sites\": [\n");
+    for(i = 0; i < FS_SITE_BUCKETS; i++) {
+        ct_fp_site* site;
+        for(site = g_ct_fp_sites[i]; site; site = site->next) {
+            if(n++) {
+                ct_fp_printf(",\n");
+            }
+            ct_fp_print_site(site);
+        }
     }
-    else if(ct_str_is(cmd->payload, "end_for")) {
-        if(clo_print_commands) VG_(printf)("end_for\n");
-        ct_pop_pagetab();
-        if(clo_print_commands && g_ct_active) VG_(printf)("stackbot restored to %p\n",
-                (void*)g_ct_stackbot);
+    ct_fp_printf("\n]}\n");
+    VG_(close)(g_ct_fp_fd);
+    g_ct_fp_fd = -1;
+    VG_(free)(name);
+}
+
+/* the access is processed a page at a time (so typically, just once),
+   with a single page lookup, a single range check and a single range
+   update per page. */
+static inline void ct_on_access(Addr base, SizeT size, Bool store, Bool report_errors)
+{
+    int curr_thread = g_ct_curr_thread;
+    Addr addr = base;
+    Addr end = base + size;
+    if(UNLIKELY(!IS_TRACKED(base))) {
+        return;
     }
-    else if(ct_str_is(cmd->payload, "iter")) {
-        if(clo_print_commands) VG_(printf)("iter %d\n", ct_cmd_int(cmd, 4));
-        g_ct_active = True;
+    if(UNLIKELY(g_ct_fp_loop != 0) && g_ct_fp_loop->iter_lines && report_errors) {
+        ct_fp_access(base, size, store);
     }
-    else if(ct_str_is(cmd->payload, "done")) {
-        if(clo_print_commands) VG_(printf)("done %d\n", ct_cmd_int(cmd, 4));
-        g_ct_active = False;
+    while(addr < end) {
+        ct_page* page = ct_get_curr_page(addr);
+        Addr page_base = addr - BYTE_IN_PAGE(addr);
+        int from = BYTE_IN_PAGE(addr);
+        int to = end - page_base < PAGE_SIZE ? (int)(end - page_base) : PAGE_SIZE;
+        /* a store is checked against the readers inherited from enclosing levels as well */
+        ct_page* readers = store && clo_track_readers ? ct_page_readers(page, g_ct_pagetab_stack) : 0;
+        if(report_errors) {
+            int i = from;
+            while(UNLIKELY((i = ct_page_find_foreign(page, i, to, curr_thread)) >= 0)) {
+                Addr bad = page_base + i;
+                if(!ct_suppress(bad)) {
+                    VG_(printf)("checkedthreads: error - thread %d accessed %p [%p,%d], owned by %d\n",
+                            g_ct_curr_thread-1,
+                            (void*)bad, (void*)base, (int)size,
+                            ct_page_owner(page, i)-1);
+                    VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 20);
+                    /* update the owners up to the reported location, and stop */
+                    if(store && i > from) {
+                        ct_page_store(page, from, i - from, curr_thread);
+                    }
+                    return;
+                }
+                ++i;
+            }
+            i = from;
+            while(UNLIKELY(readers && (i = ct_page_find_foreign(readers, i, to, curr_thread)) >= 0)) {
+                Addr bad = page_base + i;
+                if(!ct_suppress(bad)) {
+                    int reader = ct_page_owner(readers, i);
+                    if(reader == READER_SHARED) {
+                        VG_(printf)("checkedthreads: error - thread %d accessed %p [%p,%d], read by several threads\n",
+                                g_ct_curr_thread-1, (void*)bad, (void*)base, (int)size);
+                    }
+                    else {
+                        VG_(printf)("checkedthreads: error - thread %d accessed %p [%p,%d], read by %d\n",
+                                g_ct_curr_thread-1, (void*)bad, (void*)base, (int)size, reader-1);
+                    }
+                    VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 20);
+                    if(i > from) {
+                        ct_page_store(page, from, i - from, curr_thread);
+                    }
+                    return;
+                }
+                ++i;
+            }
+        }
+        if(store && report_errors && clo_report_false_sharing) {
+            ct_check_false_sharing(page, page_base, from, to, curr_thread);
+        }
+        if(store) {
+            /* update the owners; a store which isn't checked (an allocation,
+               or an iteration out of the --check-sample) forgets the readers */
+            ct_page_store(page, from, to - from, curr_thread);
+            if(!report_errors && readers) {
+                ct_page_store(readers, from, to - from, 0);
+            }
+        }
+        else if(clo_track_readers) {
+            ct_page_read(page, g_ct_pagetab_stack, from, to - from, curr_thread);
+        }
+        addr = page_base + to;
     }
-    else if(ct_str_is(cmd->payload, "setactiv")) {
-        g_ct_active = (Bool)ct_cmd_int(cmd, 8);
+}
+
+/* --check-sample: whether to check an iteration is a hash of the seed, the
+   loop and the index, so the sample is reproducible from $CT_RAND_SEED */
+static UInt g_ct_sample_seed = 0;
+static ULong g_ct_iters_checked = 0;
+static ULong g_ct_iters_unchecked = 0;
+
+static UInt ct_mix(UInt x) /* murmur3's finalizer */
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return x;
+}
+
+static Bool ct_sampled(Int index)
+{
+    Bool sampled = clo_check_sample >= 1.0
+        || ct_mix(g_ct_sample_seed ^ ct_mix(g_ct_loop_id ^ ct_mix((UInt)index)))
+           < (UInt)(clo_check_sample * 4294967296.0);
+    if(sampled) {
+        g_ct_iters_checked++;
     }
-    else if(ct_str_is(cmd->payload, "thrd")) {
-        g_ct_curr_thread = ct_cmd_int(cmd, 4)+1;
+    else {
+        g_ct_iters_unchecked++;
+    }
+    return sampled;
+}
+
+static Bool ct_handle_client_request(ThreadId tid, UWord* arg, UWord* ret)
+{
+    if(!VG_IS_TOOL_USERREQ('C','T',arg[0])) {
+        return False;
     }
-    else if(ct_str_is(cmd->payload, "stackbot")) {
-        g_ct_stackbot = (char*)ct_cmd_ptr(cmd, 8);
+    *ret = 0;
+    switch(arg[0]) {
+    case CT_USERREQ_BEGIN_FOR:
+        ct_push_pagetab();
+        if(clo_footprint_file) ct_fp_begin_loop(tid);
+        g_ct_stackbot = (char*)arg[1];
         g_ct_stackend = ct_stack_end();
-        if(clo_print_commands) VG_(printf)("stackbot %p [stackend %p]\n",
+        g_ct_loop_id = g_ct_num_loops++;
+        ct_set_active(False, g_ct_checked);
+        if(clo_print_commands) VG_(printf)("begin_for, stackbot %p [stackend %p]\n",
                 (void*)g_ct_stackbot, (void*)g_ct_stackend);
-    }
-    else if(ct_str_is(cmd->payload, "getowner")) {
-        Addr addr = ct_cmd_ptr(cmd, 8);
+        break;
+    case CT_USERREQ_END_FOR:
+        if(clo_print_commands) VG_(printf)("end_for\n");
+        ct_pop_pagetab();
+        if(clo_footprint_file) ct_fp_end_loop();
+        if(clo_print_commands && g_ct_active) VG_(printf)("stackbot restored to %p\n",
+                (void*)g_ct_stackbot);
+        break;
+    case CT_USERREQ_ITER:
+        if(clo_print_commands) VG_(printf)("iter %d\n", (int)arg[2]);
+        g_ct_curr_thread = (int)arg[1]+1;
+        ct_set_active(True, ct_sampled((Int)arg[2]));
+        if(clo_footprint_file) ct_fp_begin_iter();
+        break;
+    case CT_USERREQ_DONE:
+        if(clo_print_commands) VG_(printf)("done %d\n", (int)arg[1]);
+        ct_set_active(False, g_ct_checked);
+        if(clo_footprint_file) ct_fp_end_iter(g_ct_fp_loop);
+        break;
+    case CT_USERREQ_SET_SEED:
+        g_ct_sample_seed = (UInt)arg[1];
+        break;
+    case CT_USERREQ_GET_OWNER: {
+        Addr addr = arg[1];
         int owner = 0;
-        ct_page* page = ct_get_page(addr, g_ct_pagetab_L3, 1);
+        ct_page* page = g_ct_pagetab_L3 && IS_TRACKED(addr) ? ct_get_curr_page(addr) : 0;
         if(page) {
-            int index_in_page = BYTE_IN_PAGE(addr);
-            owner = page->owning_thread[index_in_page];
+            owner = ct_page_owner(page, BYTE_IN_PAGE(addr));
         }
-        cmd->stored_magic = owner-1;
+        *ret = (UWord)(Word)(owner-1);
         if(clo_print_commands) VG_(printf)("getowner %p -> %d\n", (void*)addr, owner-1);
+        break;
     }
-    else {
-        VG_(printf)("checkedthreads: WARNING - unknown command!\n");
-        VG_(get_and_pp_StackTrace)(VG_(get_running_tid)(), 20);
+    default:
+        VG_(printf)("checkedthreads: WARNING - unknown client request %#lx!\n", (unsigned long)arg[0]);
+        VG_(get_and_pp_StackTrace)(tid, 20);
+        return False;
     }
-    g_ct_last_cmd = cmd;
+    return True;
 }
 
 static VG_REGPARM(2) void trace_load(Addr addr, SizeT size)
 {
-    if(g_ct_active) {
+    if(g_ct_checking_loads) {
         ct_on_access(addr, size, False, True);
     }
 }
 
 static inline void ct_on_store(Addr addr, SizeT size)
 {
-   ct_cmd* p = (ct_cmd*)addr;
-   if(p->stored_magic == MAGIC) {
-       ct_process_command(p);
-   }
    if(g_ct_active) {
-       ct_on_access(addr, size, True, True);
+       ct_on_access(addr, size, True, g_ct_checked);
    }
 }
 
@@ -529,12 +1814,84 @@ static VG_REGPARM(2) void trace_store(Addr addr, SizeT size)
     ct_on_store(addr, size);
 }
 
+/* memcpy & co, checked at their entry (see ct_mem_function) */
+static ULong g_ct_mem_calls = 0;
+
+static VG_REGPARM(3) void trace_mem_copy(Addr dst, Addr src, SizeT len)
+{
+   g_ct_mem_calls++;
+   if(clo_check_level == CHECK_ALL) {
+       trace_load(src, len);
+   }
+   ct_on_store(dst, len);
+}
+
+static VG_REGPARM(2) void trace_mem_set(Addr dst, SizeT len)
+{
+   g_ct_mem_calls++;
+   ct_on_store(dst, len);
+}
+
 static VG_REGPARM(2) void trace_modify(Addr addr, SizeT size)
 {
     ct_on_store(addr, size);
 }
 
 
+#if defined(VG_BIGENDIAN)
+#define CT_ENDNESS Iend_BE
+#else
+#define CT_ENDNESS Iend_LE
+#endif
+
+/* emits IR testing a flag (g_ct_active or g_ct_checking_loads). the flags
+   can only change in a client request, and client requests end the
+   superblock, so one test covers all the helper calls emitted by a flush. */
+static IRTemp ct_active_guard(IRSB* sb, Bool* flag)
+{
+   IRTemp active = newIRTemp(sb->tyenv, Ity_I8);
+   IRTemp wide   = newIRTemp(sb->tyenv, Ity_I32);
+   IRTemp guard  = newIRTemp(sb->tyenv, Ity_I1);
+   tl_assert(sizeof(*flag) == 1);
+   addStmtToIRSB( sb, IRStmt_WrTmp(active,
+            IRExpr_Load(CT_ENDNESS, Ity_I8, mkIRExpr_HWord((HWord)flag))) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(wide,
+            IRExpr_Unop(Iop_8Uto32, IRExpr_RdTmp(active))) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(guard,
+            IRExpr_Binop(Iop_CmpNE32, IRExpr_RdTmp(wide), IRExpr_Const(IRConst_U32(0)))) );
+   return guard;
+}
+
+/* emits IR testing active && addr >= stackbot, for an access at SP/FP plus
+   a constant. an iteration's own frames are below stackbot, but the locals
+   of an iteration spawning a nested loop are above the nested loop's
+   stackbot - where other iterations may have stored - so those are checked.
+   like the flags, stackbot only changes in client requests; it's loaded
+   into *stackbot once per flush. */
+static IRTemp ct_above_stackbot_guard(IRSB* sb, IRTemp active, IRTemp* stackbot, IRExpr* addr)
+{
+   Bool   is64  = sizeof(HWord) == 8;
+   IRType ty    = is64 ? Ity_I64 : Ity_I32;
+   IROp   cmplt = is64 ? Iop_CmpLT64U : Iop_CmpLT32U;
+   IROp   widen = is64 ? Iop_1Uto64 : Iop_1Uto32;
+   IRTemp below      = newIRTemp(sb->tyenv, Ity_I1);
+   IRTemp below_wide = newIRTemp(sb->tyenv, ty);
+   IRTemp act_wide   = newIRTemp(sb->tyenv, ty);
+   IRTemp guard      = newIRTemp(sb->tyenv, Ity_I1);
+   if (*stackbot == IRTemp_INVALID) {
+      *stackbot = newIRTemp(sb->tyenv, ty);
+      addStmtToIRSB( sb, IRStmt_WrTmp(*stackbot,
+               IRExpr_Load(CT_ENDNESS, ty, mkIRExpr_HWord((HWord)&g_ct_stackbot))) );
+   }
+   addStmtToIRSB( sb, IRStmt_WrTmp(below, IRExpr_Binop(cmplt, addr, IRExpr_RdTmp(*stackbot))) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(below_wide, IRExpr_Unop(widen, IRExpr_RdTmp(below))) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(act_wide, IRExpr_Unop(widen, IRExpr_RdTmp(active))) );
+   /* !below && active is below_wide < act_wide */
+   addStmtToIRSB( sb, IRStmt_WrTmp(guard,
+            IRExpr_Binop(cmplt, IRExpr_RdTmp(below_wide), IRExpr_RdTmp(act_wide))) );
+   return guard;
+}
+
 static void flushEvents(IRSB* sb)
 {
    Int        i;
@@ -543,6 +1900,9 @@ static void flushEvents(IRSB* sb)
    IRExpr**   argv;
    IRDirty*   di;
    Event*     ev;
+   IRTemp     store_guard = IRTemp_INVALID;
+   IRTemp     load_guard = IRTemp_INVALID;
+   IRTemp     stackbot = IRTemp_INVALID;
 
    for (i = 0; i < events_used; i++) {
 
@@ -566,12 +1926,19 @@ static void flushEvents(IRSB* sb)
             tl_assert(0);
       }
 
-      // Add the helper.
+      // Add the helper, called only while checking is active - so code
+      // outside ct_for (setup, I/O...) doesn't pay for the calls.
       if (helperAddr) {
+          IRTemp* guard = ev->ekind == Event_Dr ? &load_guard : &store_guard;
+          if (*guard == IRTemp_INVALID) {
+              *guard = ct_active_guard(sb, ev->ekind == Event_Dr ? &g_ct_checking_loads : &g_ct_active);
+          }
           argv = mkIRExprVec_2( ev->addr, mkIRExpr_HWord( ev->size ) );
           di   = unsafeIRDirty_0_N( /*regparms*/2, 
                   helperName, VG_(fnptr_to_fnentry)( helperAddr ),
                   argv );
+          di->guard = IRExpr_RdTmp(ev->stack ? ct_above_stackbot_guard(sb, *guard, &stackbot, ev->addr)
+                                             : *guard);
           addStmtToIRSB( sb, IRStmt_Dirty(di) );
       }
    }
@@ -600,11 +1967,12 @@ static void addEvent_Ir ( IRSB* sb, IRAtom* iaddr, UInt isize )
    evt->ekind = Event_Ir;
    evt->addr  = iaddr;
    evt->size  = isize;
+   evt->stack = False;
    events_used++;
 }
 
 static
-void addEvent_Dr ( IRSB* sb, IRAtom* daddr, Int dsize )
+void addEvent_Dr ( IRSB* sb, IRAtom* daddr, Int dsize, Bool stack )
 {
    Event* evt;
    tl_assert(clo_trace_mem);
@@ -617,11 +1985,12 @@ void addEvent_Dr ( IRSB* sb, IRAtom* daddr, Int dsize )
    evt->ekind = Event_Dr;
    evt->addr  = daddr;
    evt->size  = dsize;
+   evt->stack = stack;
    events_used++;
 }
 
 static
-void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize )
+void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize, Bool stack )
 {
    Event* lastEvt;
    Event* evt;
@@ -634,6 +2003,7 @@ void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize )
    if (events_used > 0
     && lastEvt->ekind == Event_Dr
     && lastEvt->size  == dsize
+    && lastEvt->stack == stack
     && eqIRAtom(lastEvt->addr, daddr))
    {
       lastEvt->ekind = Event_Dm;
@@ -648,6 +2018,7 @@ void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize )
    evt->ekind = Event_Dw;
    evt->size  = dsize;
    evt->addr  = daddr;
+   evt->stack = stack;
    events_used++;
 }
 
@@ -660,6 +2031,297 @@ static void ct_post_clo_init(void)
 {
 }
 
+/* accesses to the frames of the running loop body are below stackbot,
+   so they are never reported; with --skip-stack-accesses, those whose
+   address is SP (or FP) plus a small constant skip the helper call when
+   they're below stackbot (see ct_above_stackbot_guard). for each IR temp,
+   we keep its offset from SP/FP, if it's known to be such a value. */
+#define MAX_STACK_OFFSET 0x10000
+#define NOT_STACK_OFFSET ((Long)1 << 62)
+
+static Long* g_ct_stack_offsets = 0;
+static Int g_ct_max_stack_offsets = 0;
+static ULong g_ct_accesses_instrumented = 0;
+static ULong g_ct_stack_accesses_guarded = 0;
+
+static void ct_reset_stack_offsets(IRTypeEnv* tyenv)
+{
+   Int i;
+   if (tyenv->types_used > g_ct_max_stack_offsets) {
+      g_ct_max_stack_offsets = 2*tyenv->types_used;
+      g_ct_stack_offsets = VG_(realloc)("stack_offsets", g_ct_stack_offsets,
+                                        g_ct_max_stack_offsets * sizeof(Long));
+   }
+   for (i = 0; i < tyenv->types_used; i++) {
+      g_ct_stack_offsets[i] = NOT_STACK_OFFSET;
+   }
+}
+
+static Long ct_stack_offset(IRExpr* e)
+{
+   return e->tag == Iex_RdTmp ? g_ct_stack_offsets[e->Iex.RdTmp.tmp] : NOT_STACK_OFFSET;
+}
+
+static Bool ct_const_value(IRExpr* e, Long* value)
+{
+   if (e->tag != Iex_Const) {
+      return False;
+   }
+   switch (e->Iex.Const.con->tag) {
+      case Ico_U32: *value = (Int)e->Iex.Const.con->Ico.U32; return True;
+      case Ico_U64: *value = (Long)e->Iex.Const.con->Ico.U64; return True;
+      default: return False;
+   }
+}
+
+/* called on each WrTmp, before the temp is used */
+static void ct_track_stack_offset(IRStmt* st, VexGuestLayout* layout)
+{
+   IRExpr* data = st->Ist.WrTmp.data;
+   Long offset = NOT_STACK_OFFSET, c;
+   switch (data->tag) {
+      case Iex_Get:
+         if (sizeofIRType(data->Iex.Get.ty) == layout->sizeof_SP
+             && (data->Iex.Get.offset == layout->offset_SP
+                 || (clo_skip_stack == SKIP_STACK_SP_FP && data->Iex.Get.offset == layout->offset_FP))) {
+            offset = 0;
+         }
+         break;
+      case Iex_RdTmp:
+         offset = ct_stack_offset(data);
+         break;
+      case Iex_Binop:
+         switch (data->Iex.Binop.op) {
+            case Iop_Add32: case Iop_Add64:
+               if (ct_const_value(data->Iex.Binop.arg2, &c)) {
+                  offset = ct_stack_offset(data->Iex.Binop.arg1);
+               }
+               else if (ct_const_value(data->Iex.Binop.arg1, &c)) {
+                  offset = ct_stack_offset(data->Iex.Binop.arg2);
+               }
+               break;
+            case Iop_Sub32: case Iop_Sub64:
+               if (ct_const_value(data->Iex.Binop.arg2, &c)) {
+                  offset = ct_stack_offset(data->Iex.Binop.arg1);
+                  c = -c;
+               }
+               break;
+            default:
+               break;
+         }
+         if (offset != NOT_STACK_OFFSET) {
+            offset += c;
+            if (offset <= -MAX_STACK_OFFSET || offset >= MAX_STACK_OFFSET) {
+               offset = NOT_STACK_OFFSET;
+            }
+         }
+         break;
+      default:
+         break;
+   }
+   g_ct_stack_offsets[st->Ist.WrTmp.tmp] = offset;
+}
+
+/* memcpy, memmove, mempcpy and memset in libc (including their _chk and
+   CPU-specific variants, like __memmove_avx_unaligned_erms) get a single
+   helper call at their entry, checking the source and destination ranges
+   a page at a time, instead of a call per load and store - one per 16
+   or 32 bytes with vector instructions. their own accesses aren't
+   instrumented. */
+#define MEMFN_NONE 0
+#define MEMFN_COPY 1 /* (dst, src, len) */
+#define MEMFN_SET  2 /* (dst, c, len) */
+
+static Bool g_ct_in_mem_function = False; /* the instruction being instrumented is in one */
+static ULong g_ct_mem_accesses_skipped = 0;
+
+/* a name's kind, ignoring leading underscores and a symbol version
+   (memcpy@@GLIBC_2.14) */
+static Int ct_mem_function_kind(const Char* name)
+{
+   static const Char* copies[] = { "memcpy", "memmove", "mempcpy" };
+   Int i;
+   while (*name == '_')
+      name++;
+   for (i = 0; i < sizeof(copies)/sizeof(copies[0]); i++) {
+      SizeT len = VG_(strlen)(copies[i]);
+      if (VG_(strncmp)(name, copies[i], len) == 0
+          && (name[len] == 0 || name[len] == '_' || name[len] == '@'))
+         return MEMFN_COPY;
+   }
+   if (VG_(strncmp)(name, "memset", 6) == 0 && (name[6] == 0 || name[6] == '_' || name[6] == '@'))
+      return MEMFN_SET;
+   return MEMFN_NONE;
+}
+
+#if defined(VGA_amd64) || defined(VGA_x86)
+/* the mem* functions' code: sorted ranges, rebuilt from libc's symbols
+   (on the next translation) after executable code is mapped or libc's is
+   unmapped - so translating an instruction takes a binary search rather
+   than a symbol lookup */
+typedef struct {
+   Addr start;
+   Addr end;
+   Int kind;
+} ct_memfn_range;
+
+static ct_memfn_range* g_ct_memfn_ranges = 0;
+static Int g_ct_num_memfn_ranges = 0;
+static Int g_ct_max_memfn_ranges = 0;
+
+static void ct_add_memfn_range(Addr start, UInt size, Int kind)
+{
+   if (g_ct_num_memfn_ranges == g_ct_max_memfn_ranges) {
+      g_ct_max_memfn_ranges = g_ct_max_memfn_ranges ? 2*g_ct_max_memfn_ranges : 64;
+      g_ct_memfn_ranges = (ct_memfn_range*)VG_(realloc)("memfn_ranges", g_ct_memfn_ranges,
+              g_ct_max_memfn_ranges * sizeof(ct_memfn_range));
+   }
+   g_ct_memfn_ranges[g_ct_num_memfn_ranges].start = start;
+   g_ct_memfn_ranges[g_ct_num_memfn_ranges].end = start + size;
+   g_ct_memfn_ranges[g_ct_num_memfn_ranges].kind = kind;
+   g_ct_num_memfn_ranges++;
+}
+
+/* a symbol's kind, by its name or any of its aliases */
+static Int ct_mem_symbol_kind(const UChar* pri_name, UChar** sec_names)
+{
+   Int kind = ct_mem_function_kind((const Char*)pri_name);
+   for (; kind == MEMFN_NONE && sec_names && *sec_names; sec_names++)
+      kind = ct_mem_function_kind((const Char*)*sec_names);
+   return kind;
+}
+
+static void ct_build_memfn_ranges(void)
+{
+   const DebugInfo* di;
+   g_ct_num_memfn_ranges = 0;
+   g_ct_memfn_text_start = g_ct_memfn_text_end = 0;
+   for (di = VG_(next_DebugInfo)(NULL); di; di = VG_(next_DebugInfo)(di)) {
+      /* a program's own memcpy_foo may take other arguments */
+      const UChar* soname = VG_(DebugInfo_get_soname)(di);
+      Addr text;
+      Int i, n;
+      if (!soname || VG_(strncmp)((const Char*)soname, "libc.so", 7) != 0)
+         continue;
+      text = VG_(DebugInfo_get_text_avma)(di);
+      if (g_ct_memfn_text_end == 0 || text < g_ct_memfn_text_start)
+         g_ct_memfn_text_start = text;
+      if (text + VG_(DebugInfo_get_text_size)(di) > g_ct_memfn_text_end)
+         g_ct_memfn_text_end = text + VG_(DebugInfo_get_text_size)(di);
+      n = VG_(DebugInfo_syms_howmany)(di);
+      for (i = 0; i < n; i++) {
+         Addr avma, tocptr;
+         UInt size;
+         UChar* pri_name;
+         UChar** sec_names;
+         Bool is_text, is_ifunc;
+         Int kind;
+         VG_(DebugInfo_syms_getidx)(di, i, &avma, &tocptr, &size, &pri_name, &sec_names,
+                                    &is_text, &is_ifunc);
+         /* an ifunc symbol is the resolver choosing the implementation */
+         if (!is_text || is_ifunc || size == 0)
+            continue;
+         kind = ct_mem_symbol_kind(pri_name, sec_names);
+         if (kind != MEMFN_NONE)
+            ct_add_memfn_range(avma, size, kind);
+      }
+   }
+   if (g_ct_num_memfn_ranges > 0) {
+      VG_(ssort)(g_ct_memfn_ranges, g_ct_num_memfn_ranges, sizeof(ct_memfn_range), ct_cmp_ranges);
+   }
+   g_ct_memfn_ranges_stale = False;
+}
+#endif
+
+/* the kind of mem* function the instruction at addr is in; *entry tells
+   if it's the function's first instruction */
+static Int ct_mem_function(Addr addr, Bool* entry)
+{
+#if defined(VGA_amd64) || defined(VGA_x86)
+   Int lo = 0, hi;
+   if (g_ct_memfn_ranges_stale)
+      ct_build_memfn_ranges();
+   if (addr < g_ct_memfn_text_start || addr >= g_ct_memfn_text_end)
+      return MEMFN_NONE;
+   hi = g_ct_num_memfn_ranges;
+   while (lo < hi) {
+      Int mid = lo + (hi - lo)/2;
+      if (addr < g_ct_memfn_ranges[mid].start)
+         hi = mid;
+      else if (addr >= g_ct_memfn_ranges[mid].end)
+         lo = mid + 1;
+      else {
+         *entry = addr == g_ct_memfn_ranges[mid].start;
+         return g_ct_memfn_ranges[mid].kind;
+      }
+   }
+   return MEMFN_NONE;
+#else
+   return MEMFN_NONE;
+#endif
+}
+
+#if defined(VGA_amd64) || defined(VGA_x86)
+/* the i-th integer argument of a function at its entry */
+static IRExpr* ct_entry_arg(IRSB* sb, VexGuestLayout* layout, Int i)
+{
+#if defined(VGA_amd64)
+   static const Int offsets[3] = { offsetof(VexGuestAMD64State, guest_RDI),
+                                   offsetof(VexGuestAMD64State, guest_RSI),
+                                   offsetof(VexGuestAMD64State, guest_RDX) };
+   IRTemp arg = newIRTemp(sb->tyenv, Ity_I64);
+   addStmtToIRSB( sb, IRStmt_WrTmp(arg, IRExpr_Get(offsets[i], Ity_I64)) );
+#else
+   /* on the stack, above the return address */
+   IRTemp sp   = newIRTemp(sb->tyenv, Ity_I32);
+   IRTemp addr = newIRTemp(sb->tyenv, Ity_I32);
+   IRTemp arg  = newIRTemp(sb->tyenv, Ity_I32);
+   addStmtToIRSB( sb, IRStmt_WrTmp(sp, IRExpr_Get(layout->offset_SP, Ity_I32)) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(addr, IRExpr_Binop(Iop_Add32, IRExpr_RdTmp(sp),
+                                                      IRExpr_Const(IRConst_U32(4*(i+1))))) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(arg, IRExpr_Load(CT_ENDNESS, Ity_I32, IRExpr_RdTmp(addr))) );
+#endif
+   return IRExpr_RdTmp(arg);
+}
+#endif
+
+static void ct_add_mem_function_call(IRSB* sb, VexGuestLayout* layout, Int kind)
+{
+#if defined(VGA_amd64) || defined(VGA_x86)
+   IRDirty* di;
+   IRTemp guard = ct_active_guard(sb, &g_ct_active);
+   if (kind == MEMFN_COPY) {
+      di = unsafeIRDirty_0_N( /*regparms*/3, "trace_mem_copy",
+              VG_(fnptr_to_fnentry)( trace_mem_copy ),
+              mkIRExprVec_3( ct_entry_arg(sb, layout, 0), ct_entry_arg(sb, layout, 1),
+                             ct_entry_arg(sb, layout, 2) ) );
+   }
+   else {
+      di = unsafeIRDirty_0_N( /*regparms*/2, "trace_mem_set",
+              VG_(fnptr_to_fnentry)( trace_mem_set ),
+              mkIRExprVec_2( ct_entry_arg(sb, layout, 0), ct_entry_arg(sb, layout, 2) ) );
+   }
+   di->guard = IRExpr_RdTmp(guard);
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+#endif
+}
+
+/* whether an access at addr should get a helper call; *stack tells if the
+   call should be skipped below stackbot */
+static Bool ct_instrumented(IRExpr* addr, Bool* stack)
+{
+   if (g_ct_in_mem_function) {
+      g_ct_mem_accesses_skipped++;
+      return False;
+   }
+   *stack = clo_skip_stack != SKIP_STACK_NO && ct_stack_offset(addr) != NOT_STACK_OFFSET;
+   if (*stack) {
+      g_ct_stack_accesses_guarded++;
+   }
+   g_ct_accesses_instrumented++;
+   return True;
+}
+
 static
 IRSB* ct_instrument ( VgCallbackClosure* closure,
                       IRSB* sbIn, 
@@ -670,6 +2332,7 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
    Int        i;
    IRSB*      sbOut;
    IRTypeEnv* tyenv = sbIn->tyenv;
+   Bool       stack;
 
    if (gWordTy != hWordTy) {
       /* We don't currently support this case. */
@@ -689,6 +2352,8 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
    if (clo_trace_mem) {
       events_used = 0;
    }
+   ct_reset_stack_offsets(tyenv);
+   g_ct_in_mem_function = False;
 
    for (/*use current i*/; i < sbIn->stmts_used; i++) {
       IRStmt* st = sbIn->stmts[i];
@@ -703,7 +2368,9 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
             addStmtToIRSB( sbOut, st );
             break;
 
-         case Ist_IMark:
+         case Ist_IMark: {
+            Bool entry = False;
+            Int kind = ct_mem_function(st->Ist.IMark.addr, &entry);
             if (clo_trace_mem) {
                // WARNING: do not remove this function call, even if you
                // aren't interested in instruction reads.  See the comment
@@ -712,25 +2379,33 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
                             st->Ist.IMark.len );
             }
             addStmtToIRSB( sbOut, st );
+            g_ct_in_mem_function = kind != MEMFN_NONE;
+            if (clo_trace_mem && entry) {
+               flushEvents(sbOut);
+               ct_add_mem_function_call(sbOut, layout, kind);
+            }
             break;
+         }
 
          case Ist_WrTmp:
             // Add a call to trace_load() if --trace-mem=yes.
             if (clo_trace_mem) {
                IRExpr* data = st->Ist.WrTmp.data;
-               if (data->tag == Iex_Load) {
+               if (data->tag == Iex_Load && clo_check_level == CHECK_ALL
+                   && ct_instrumented(data->Iex.Load.addr, &stack)) {
                   addEvent_Dr( sbOut, data->Iex.Load.addr,
-                               sizeofIRType(data->Iex.Load.ty) );
+                               sizeofIRType(data->Iex.Load.ty), stack );
                }
             }
+            ct_track_stack_offset( st, layout );
             addStmtToIRSB( sbOut, st );
             break;
 
          case Ist_Store:
-            if (clo_trace_mem) {
+            if (clo_trace_mem && ct_instrumented(st->Ist.Store.addr, &stack)) {
                IRExpr* data  = st->Ist.Store.data;
                addEvent_Dw( sbOut, st->Ist.Store.addr,
-                            sizeofIRType(typeOfIRExpr(tyenv, data)) );
+                            sizeofIRType(typeOfIRExpr(tyenv, data)), stack );
             }
             addStmtToIRSB( sbOut, st );
             break;
@@ -755,9 +2430,10 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
             dataSize = sizeofIRType(dataTy);
             if (cas->dataHi != NULL)
                dataSize *= 2; /* since it's a doubleword-CAS */
-            if (clo_trace_mem) {
-               addEvent_Dr( sbOut, cas->addr, dataSize );
-               addEvent_Dw( sbOut, cas->addr, dataSize );
+            if (clo_trace_mem && ct_instrumented(cas->addr, &stack)) {
+               if (clo_check_level == CHECK_ALL)
+                  addEvent_Dr( sbOut, cas->addr, dataSize, stack );
+               addEvent_Dw( sbOut, cas->addr, dataSize, stack );
             }
             addStmtToIRSB( sbOut, st );
             break;
@@ -768,15 +2444,16 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
             if (st->Ist.LLSC.storedata == NULL) {
                /* LL */
                dataTy = typeOfIRTemp(tyenv, st->Ist.LLSC.result);
-               if (clo_trace_mem)
+               if (clo_trace_mem && clo_check_level == CHECK_ALL
+                   && ct_instrumented(st->Ist.LLSC.addr, &stack))
                   addEvent_Dr( sbOut, st->Ist.LLSC.addr,
-                                      sizeofIRType(dataTy) );
+                                      sizeofIRType(dataTy), stack );
             } else {
                /* SC */
                dataTy = typeOfIRExpr(tyenv, st->Ist.LLSC.storedata);
-               if (clo_trace_mem)
+               if (clo_trace_mem && ct_instrumented(st->Ist.LLSC.addr, &stack))
                   addEvent_Dw( sbOut, st->Ist.LLSC.addr,
-                                      sizeofIRType(dataTy) );
+                                      sizeofIRType(dataTy), stack );
             }
             addStmtToIRSB( sbOut, st );
             break;
@@ -806,6 +2483,28 @@ IRSB* ct_instrument ( VgCallbackClosure* closure,
 
 static void ct_fini(Int exitcode)
 {
+    if(VG_(clo_stats)) {
+        VG_(printf)("checkedthreads: shadow memory: %lu bytes peak, %lu bytes at exit\n",
+                (unsigned long)g_ct_peak_shadow_bytes, (unsigned long)g_ct_shadow_bytes);
+        VG_(printf)("checkedthreads: shadow pages: %llu allocated, %llu shared copy-on-write, "
+                "%llu refined to words, %llu refined to bytes\n",
+                g_ct_pages_allocated, g_ct_pages_shared,
+                g_ct_pages_refined[GRAN_WORD], g_ct_pages_refined[GRAN_BYTE]);
+        VG_(printf)("checkedthreads: translated accesses: %llu instrumented, %llu of them at the stack "
+                "pointer and skipped below stackbot\n",
+                g_ct_accesses_instrumented, g_ct_stack_accesses_guarded);
+        VG_(printf)("checkedthreads: iterations: %llu checked, %llu unchecked\n",
+                g_ct_iters_checked, g_ct_iters_unchecked);
+        VG_(printf)("checkedthreads: mem* functions: %llu calls checked by range, "
+                "%llu translated accesses in them skipped\n",
+                g_ct_mem_calls, g_ct_mem_accesses_skipped);
+    }
+    if(clo_report_false_sharing) {
+        ct_print_false_sharing();
+    }
+    if(clo_footprint_file) {
+        ct_fp_write_report();
+    }
 }
 
 //dynamic memory: when allocated, set the allocating thread as the owner.
@@ -821,6 +2520,7 @@ static void* alloc_and_record_block(SizeT req_szB, SizeT req_alignB, Bool is_zer
         return NULL;
     }
     if (is_zeroed) VG_(memset)(p, 0, req_szB);
+    if (clo_report_false_sharing) ct_record_block((Addr)p, req_szB);
 
     if(g_ct_active) {
         ct_on_access((Addr)p, req_szB, True, False);
@@ -831,6 +2531,9 @@ static void* alloc_and_record_block(SizeT req_szB, SizeT req_alignB, Bool is_zer
 
 static void unrecord_block(void* p)
 {
+    if(clo_report_false_sharing) {
+        ct_forget_block((Addr)p);
+    }
     if(g_ct_active) {
         int real_curr_thread = g_ct_curr_thread;
         g_ct_curr_thread = OWNER_INACCESSIBLE;
@@ -917,6 +2620,10 @@ static void ct_pre_clo_init(void)
    VG_(needs_command_line_options)(ct_process_cmd_line_option,
                                    ct_print_usage,
                                    ct_print_debug_usage);
+   VG_(needs_client_requests)     (ct_handle_client_request);
+   VG_(track_new_mem_startup)     (ct_new_mem_mapped);
+   VG_(track_new_mem_mmap)        (ct_new_mem_mapped);
+   VG_(track_die_mem_munmap)      (ct_die_mem_munmap);
    VG_(needs_malloc_replacement)  (ct_malloc,
                                    ct___builtin_new,
                                    ct___builtin_vec_new,